@@ -12,12 +12,11 @@
 #include <zephyr/pm/device.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/drivers/uart.h>
+#include <string.h>
 #include <thread_dongle_interface.h>
 
 #include "coap_client_utils.h"
-
-// Server polling period
-#define SERVER_POLLING_PERIOD_MS 10000
+#include "periodic_scheduler.h"
 
 // UART variables
 #define UART_RECEIVE_TIMEOUT 500000
@@ -29,37 +28,76 @@ static uint8_t rx_buf[MSG_BUFF_SIZE] = {0};
 static uint8_t rx_msg_buf[MSG_MAX_SIZE] = {0};
 static uint8_t rx_offset=0;
 
-/*Send the server ressources status via uart*/
-static void uart_send_server_ressources_status(){
+static struct periodic_task server_polling_task;
+static struct periodic_task uart_refresh_task;
+static bool uart_status_reported;
+
+/*Send the server ressources status via uart, only when it changed unless refresh is set*/
+static void uart_send_server_ressources_status(bool refresh){
 
     bool wifi_status = get_server_wifi_status();
     bool presence_status = get_server_presence_status();
     bool electrical_status = get_server_electrical_status();
 
-    printk("SERVER [DEBBUG]: current ressources status  wifi:%d   presence:%d   electrical:%d\r\n", wifi_status, presence_status, electrical_status);
-
-    // msg buffer
+    // Last frame sent, also the last state reported to the host
     static uint8_t tx_buf[] =   "~wifi:0prs:0ele:0#";
+    uint8_t frame[sizeof(tx_buf)];
+
+    memcpy(frame, tx_buf, sizeof(frame));
 
     // Add wifi status
-    if(wifi_status){tx_buf[6] = '1';}
-    else{tx_buf[6] = '0';}
+    if(wifi_status){frame[6] = '1';}
+    else{frame[6] = '0';}
 
     // Add presence status
-    if(presence_status){tx_buf[11] = '1';}
-    else{tx_buf[11] = '0';}
+    if(presence_status){frame[11] = '1';}
+    else{frame[11] = '0';}
 
     // Add electrical status
-    if(electrical_status){tx_buf[16] = '1';}
-    else{tx_buf[16] = '0';}
+    if(electrical_status){frame[16] = '1';}
+    else{frame[16] = '0';}
+
+    if (uart_status_reported && !refresh && (memcmp(frame, tx_buf, sizeof(frame)) == 0)) {
+        return;
+    }
+
+    printk("SERVER [DEBBUG]: current ressources status  wifi:%d   presence:%d   electrical:%d\r\n", wifi_status, presence_status, electrical_status);
+
+    memcpy(tx_buf, frame, sizeof(tx_buf));
+    uart_status_reported = true;
 
     int ret = uart_tx(uart, tx_buf, sizeof(tx_buf), SYS_FOREVER_MS);
     printk("UART [DEBBUG]: Sending ressources status via UART: %s\r\n", tx_buf);
     if (ret) {
         printk("UART [ERROR]: Impossible to send message over UART\r\n");
-        return 1;
+        // Sent again with the next status
+        uart_status_reported = false;
+    }
+}
+
+/*Send the last reported ressources status again via uart*/
+static void uart_status_refresh(void)
+{
+    if (uart_status_reported) {
+        uart_send_server_ressources_status(true);
     }
 }
+/*Forward the downlink requests received from the server via uart*/
+static void on_downlink_request(const uint8_t *payload, uint16_t payload_len)
+{
+    static uint8_t tx_buf[DOWNLINK_PAYLOAD_MAX_SIZE + 2];
+
+    tx_buf[0] = START_CHAR;
+    memcpy(&tx_buf[1], payload, payload_len);
+    tx_buf[payload_len + 1] = END_CHAR;
+
+    int ret = uart_tx(uart, tx_buf, payload_len + 2, SYS_FOREVER_MS);
+    printk("UART [DEBBUG]: Sending downlink request via UART\r\n");
+    if (ret) {
+        printk("UART [ERROR]: Impossible to send message over UART\r\n");
+    }
+}
+
 /* Process received char from UART */
 static void process_received_char(char received_char)
 {
@@ -128,6 +166,17 @@ static void on_button_changed(uint32_t button_state, uint32_t has_changed)
     }
 }
 
+static void on_ressources_status_reply(int result, bool changed)
+{
+    if (result != 0) {
+        // Keep the last reported status, the next poll will refresh it
+        printk("UART [DEBBUG]: Ressources status not refreshed, report skipped\r\n");
+        return;
+    }
+    periodic_task_changed(&server_polling_task, changed);
+    uart_send_server_ressources_status(false);
+}
+
 int main(void)
 {
     int ret;
@@ -151,6 +200,11 @@ int main(void)
 
     // Init thread/coap
     coap_client_utils_init(on_ot_connect, on_ot_disconnect);
+
+    ret = coap_client_downlink_init(on_downlink_request);
+    if (ret) {
+        printk("THREAD [ERROR]: Cannot init downlink resource (error: %d)\r\n", ret);
+    }
     
     // Structure to configure uart communication
     const struct uart_config uart_cfg = {
@@ -177,12 +231,11 @@ int main(void)
     // Start uart receiving reception in buffer
     uart_rx_enable(uart, rx_buf, sizeof(rx_buf), UART_RECEIVE_TIMEOUT);
     
-    // loop forever waiting for uart messages
-    while (1) {                
-        coap_client_send_ressources_status_request();
-        k_msleep(SERVER_POLLING_PERIOD_MS*0.2); 
-        uart_send_server_ressources_status();
-        k_msleep(SERVER_POLLING_PERIOD_MS*0.8);     
-	}
+    // Poll the server with an offset and a jitter specific to this node, faster after each change
+    coap_client_status_reply_cb_set(on_ressources_status_reply);
+    periodic_scheduler_init(coap_client_device_hash());
+    periodic_task_adaptive_start(&server_polling_task, CONFIG_CLIENT_POLLING_MIN_PERIOD_MS, CONFIG_CLIENT_POLLING_MAX_PERIOD_MS,
+                                 coap_client_send_ressources_status_request);
+    periodic_task_start(&uart_refresh_task, CONFIG_UART_STATUS_REFRESH_PERIOD_MS, uart_status_refresh);
     return 0;
 }
@@ -7,17 +7,23 @@
 #include <zephyr/kernel.h>
 #include <thread_dongle_interface.h>
 #include <dk_buttons_and_leds.h>
-#include <net/coap_utils.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/net/openthread.h>
-#include <zephyr/net/socket.h>
 #include <openthread/thread.h>
+#include <openthread/coap.h>
+#include <openthread/ip6.h>
+#include <stdlib.h>
 
 #include "coap_client_utils.h"
+#include "coap_request_manager.h"
+#include "offline_queue.h"
+#include "server_discovery.h"
 
-static bool is_connected;
+// Device class multicast group
+#define CLIENT_CLASS_GROUP_ID GROUP_ID_BUTTONS
+
+static downlink_request_cb_t on_downlink_request;
 
-static struct k_work multicast_commands_work;
 static struct k_work ressources_status_work;
 static struct k_work send_alarm_work;
 static struct k_work send_keep_alive_work;
@@ -26,24 +32,37 @@ static struct k_work presence_status_work;
 static struct k_work on_connect_work;
 static struct k_work on_disconnect_work;
 
-/* Options supported by the server */
-static const char *const commands_option[] = { COMMANDS_URI_PATH, NULL };
-static const char *const ressources_status_option[] = { RESSOURCES_URI_PATH, NULL };
-static const char *const wifi_status_option[] = { WIFI_URI_PATH, NULL };
-static const char *const presence_status_option[] = { PRESENCE_URI_PATH, NULL };
-
-volatile uint8_t msg_buf[MSG_BUFF_SIZE] = {0};
-uint16_t msg_len = 0;
-
-/* Thread multicast mesh local address */
-static struct sockaddr_in6 multicast_local_addr = {
-     .sin6_family = AF_INET6,
-     .sin6_port = htons(COAP_PORT),
-     .sin6_addr.s6_addr = { 0xff, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 },
-     .sin6_scope_id = 0U
+/* Completion of the periodic status request, reported to the application from the system workqueue */
+static status_reply_cb_t on_status_reply;
+static struct k_work_delayable status_reply_work;
+static atomic_t status_reply_result = ATOMIC_INIT(0);
+static atomic_t status_reply_changed = ATOMIC_INIT(0);
+
+/**@brief Definition of CoAP resources for status change notifications. */
+static otCoapResource notify_resource = {
+     .mUriPath = NOTIFY_URI_PATH,
+     .mHandler = NULL,
+     .mContext = NULL,
+     .mNext = NULL,
+};
+
+/* State version of the last status notification */
+static uint32_t status_version;
+
+/**@brief Definition of CoAP resources for downlink requests. */
+static otCoapResource downlink_resource = {
+     .mUriPath = DOWNLINK_URI_PATH,
+     .mHandler = NULL,
+     .mContext = NULL,
+     .mNext = NULL,
 };
 
+/* Requests sent to the server, a keep alive msg is only needed after a silent period */
+static atomic_val_t server_requests_at_keep_alive;
+static uint8_t keep_alives_skipped = CONFIG_CLIENT_KEEP_ALIVE_SKIP_MAX;
+static uint32_t keep_alives_sent;
+static uint32_t keep_alives_suppressed;
+
 // Variable for storing orchestrator server ressources */
 struct server_ressources {
     bool wifi_status;
@@ -55,65 +74,64 @@ static struct server_ressources srv_ressources = {
     .presence_status = NULL,
 };
 
-static int on_commands_msg_reply(const struct coap_packet *response,
-                     struct coap_reply *reply,
-                     const struct sockaddr *from)
+static void on_commands_msg_reply(int result, const uint8_t *payload, uint16_t payload_size,
+                                  const otIp6Address *from)
 {
-     ARG_UNUSED(reply);
-     ARG_UNUSED(from);   
-
-     const uint8_t *payload;
-     uint16_t payload_size = 0u; 
-     char *cmd_ok = "CMD:OK";
+     char *cmd_ok = COMMANDS_OK;
 
      dk_set_led_off(RESSOURCES_STATUS_MSG_LED);
 
-     payload = coap_packet_get_payload(response, &payload_size);
+     if (result != 0) {
+          return;
+     }
+     server_reply_received(from);
+
+     if (payload == NULL) {
+          return;
+     }
 
      // Check if CMD:OK in payload
      if (strstr(payload, cmd_ok) != NULL) {
           printk("THREAD [DEBBUG]: commands msg reply: CMD_ACK\r\n"); 
           dk_set_led_off(COMMANDS_MSG_LED);     
-     }
-exit:
-     return 0;
-}
-
 
-static void send_commands_to_server_message(struct k_work *item)
-{
-     ARG_UNUSED(item);
-
-     printk("THREAD [DEBBUG]: Sending command to server \r\n");
+          // Gateway latency sent by the server once the gateway acknowledged the command
+          char* latency_in_payload = strstr(payload, COMMANDS_LATENCY);
+          if (latency_in_payload != NULL) {
+               printk("THREAD [DEBBUG]: command acknowledged by gateway, latency: %d ms\r\n",
+                      atoi(latency_in_payload + strlen(COMMANDS_LATENCY)));
+          }
+     }
 
-     int ret_coap_req = coap_send_request(
-          COAP_METHOD_PUT,(const struct sockaddr *)&multicast_local_addr,
-          commands_option, &msg_buf, msg_len, on_commands_msg_reply);
-     
-     dk_set_led_on(COMMANDS_MSG_LED);
+     // Check if CMD:TIMEOUT in payload
+     if (strstr(payload, COMMANDS_TIMEOUT) != NULL) {
+          printk("THREAD [ERROR]: command not acknowledged by gateway\r\n");
+     }
 
-     // Clear buffer
-     msg_len = 0;
-     for( int i =0; i < MSG_BUFF_SIZE; i++ ){
-          msg_buf[i] = NULL;
-     }     
+     // Check if CMD:ERROR in payload
+     if (strstr(payload, COMMANDS_ERROR) != NULL) {
+          printk("THREAD [ERROR]: command not forwarded to the gateway\r\n");
+     }
 }
 
-static int on_ressource_status_reply(const struct coap_packet *response,
-                     struct coap_reply *reply,
-                     const struct sockaddr *from)
-{
-     const uint8_t *payload;
-     uint16_t payload_size = 0u;
-
-     ARG_UNUSED(reply);
-     ARG_UNUSED(from);
 
+static void on_ressource_status_reply(int result, const uint8_t *payload, uint16_t payload_size,
+                                      const otIp6Address *from)
+{
      printk("THREAD [DEBBUG]: Ressource status reply received from server \r\n");     
 
      dk_set_led_off(RESSOURCES_STATUS_MSG_LED);
 
-     payload = coap_packet_get_payload(response, &payload_size); 
+     if (result != 0) {
+          return;
+     }
+     server_reply_received(from);
+
+     if (payload == NULL) {
+          return;
+     }
+
+     struct server_ressources previous_ressources = srv_ressources;
 
      // Check if wifi in payload
      char* wifi_in_payload = strchr(payload, 'w');
@@ -130,8 +148,11 @@ static int on_ressource_status_reply(const struct coap_packet *response,
             
      }
      print_orchestrator_server_ressources();
-exit:
-     return 0;
+
+     // Status updated: run the application action now
+     atomic_set(&status_reply_changed, memcmp(&previous_ressources, &srv_ressources, sizeof(srv_ressources)) != 0);
+     atomic_set(&status_reply_result, 0);
+     k_work_reschedule(&status_reply_work, K_NO_WAIT);
 }
 
 static void send_ressources_status_request(struct k_work *item)
@@ -140,9 +161,10 @@ static void send_ressources_status_request(struct k_work *item)
 
      printk("THREAD [DEBBUG]: Sending ressources status request to server \r\n");
 
-     coap_send_request(COAP_METHOD_GET,
-                 (const struct sockaddr *)&multicast_local_addr,
-                 ressources_status_option, NULL, 0u, on_ressource_status_reply);
+     server_status_request_send(RESSOURCES_URI_PATH, on_ressource_status_reply);
+     // Reported as timed out unless the reply arrives first
+     atomic_set(&status_reply_result, -ETIMEDOUT);
+     k_work_reschedule(&status_reply_work, K_MSEC(CONFIG_CLIENT_STATUS_REPLY_TIMEOUT_MS));
      dk_set_led_on(RESSOURCES_STATUS_MSG_LED);
 }
 
@@ -155,9 +177,7 @@ static void send_alarm(struct k_work *item)
      static uint8_t msg_buf[] = CMD1;
      uint16_t msg_len = sizeof(msg_buf);
 
-     int ret_coap_req = coap_send_request(
-          COAP_METHOD_PUT,(const struct sockaddr *)&multicast_local_addr,
-          commands_option, &msg_buf, msg_len, on_commands_msg_reply);
+     int ret_coap_req = server_request_send(OT_COAP_CODE_PUT, COMMANDS_URI_PATH, msg_buf, msg_len, on_commands_msg_reply);
      
      dk_set_led_on(COMMANDS_MSG_LED);
 }
@@ -171,9 +191,7 @@ static void send_keep_alive(struct k_work *item)
      static uint8_t msg_buf[] = KEEP_ALIVE_DEVICE_ID_2;
      uint16_t msg_len = sizeof(msg_buf);
 
-     int ret_coap_req = coap_send_request(
-          COAP_METHOD_PUT,(const struct sockaddr *)&multicast_local_addr,
-          commands_option, &msg_buf, msg_len, on_commands_msg_reply);
+     int ret_coap_req = server_request_send(OT_COAP_CODE_PUT, COMMANDS_URI_PATH, msg_buf, msg_len, on_commands_msg_reply);
      
      dk_set_led_on(COMMANDS_MSG_LED);
 }
@@ -185,9 +203,7 @@ static void send_wifi_status_request(struct k_work *item)
 
      printk("THREAD [DEBBUG]: Sending wifi status request to server \r\n");
 
-     coap_send_request(COAP_METHOD_GET,
-                 (const struct sockaddr *)&multicast_local_addr,
-                 wifi_status_option, NULL, 0u, on_ressource_status_reply);
+     server_request_send(OT_COAP_CODE_GET, WIFI_URI_PATH, NULL, 0u, on_ressource_status_reply);
      dk_set_led_on(RESSOURCES_STATUS_MSG_LED);
 }
 
@@ -197,98 +213,275 @@ static void send_presence_status_request(struct k_work *item)
 
      printk("THREAD [DEBBUG]: Sending presence status request to server \r\n");
 
-     coap_send_request(COAP_METHOD_GET,
-                 (const struct sockaddr *)&multicast_local_addr,
-                 presence_status_option, NULL, 0u, on_ressource_status_reply);
+     server_request_send(OT_COAP_CODE_GET, PRESENCE_URI_PATH, NULL, 0u, on_ressource_status_reply);
      dk_set_led_on(RESSOURCES_STATUS_MSG_LED);
 }
 
 static void on_thread_state_changed(otChangedFlags flags, struct openthread_context *ot_context,
                         void *user_data)
 {
+     bool attached = false;
+
      if (flags & OT_CHANGED_THREAD_ROLE) {
           switch (otThreadGetDeviceRole(ot_context->instance)) {
           case OT_DEVICE_ROLE_CHILD:
           case OT_DEVICE_ROLE_ROUTER:
           case OT_DEVICE_ROLE_LEADER:
+               if (server_discovery_attached()) {
+                    attached = true;
+                    // The server learns the address of this node from its keep alive msgs
+                    keep_alives_skipped = CONFIG_CLIENT_KEEP_ALIVE_SKIP_MAX;
+               }
+               if (on_downlink_request != NULL) {
+                    server_discovery_groups_subscribe(ot_context->instance, CLIENT_CLASS_GROUP_ID,
+                                                      CONFIG_CLIENT_ROOM_GROUP_ID);
+               }
                k_work_submit(&on_connect_work);
-               is_connected = true;
                break;
 
           case OT_DEVICE_ROLE_DISABLED:
           case OT_DEVICE_ROLE_DETACHED:
           default:
+               server_discovery_detached();
                k_work_submit(&on_disconnect_work);
-               is_connected = false;
                break;
           }
      }
+
+     // Resolve the server once attached and whenever the network data or the parent changes
+     if ((flags & (OT_CHANGED_THREAD_ROLE | OT_CHANGED_THREAD_NETDATA | OT_CHANGED_THREAD_RLOC_ADDED)) &&
+         server_discovery_is_attached()) {
+          server_discovery_resolve(ot_context->instance);
+     }
+
+     // Requests made while detached, sent once the server is resolved
+     if (attached) {
+          offline_queue_flush(server_offline_request_send);
+     }
+}
+
+static void downlink_response_send(otMessage *request_message,
+                      const otMessageInfo *message_info)
+{
+     otError error = OT_ERROR_NO_BUFS;
+     otMessage *response;
+     otInstance *ot = openthread_get_default_instance();
+
+     response = otCoapNewMessage(ot, NULL);
+     if (response == NULL) {
+          goto end;
+     }
+
+     error = otCoapMessageInitResponse(response, request_message,
+                           OT_COAP_TYPE_ACKNOWLEDGMENT, OT_COAP_CODE_CHANGED);
+     if (error != OT_ERROR_NONE) {
+          goto end;
+     }
+
+     error = otCoapSendResponse(ot, response, message_info);
+
+end:
+     if (error != OT_ERROR_NONE && response != NULL) {
+          otMessageFree(response);
+     }
+}
+
+static void downlink_request_handler(void *context, otMessage *message,
+                      const otMessageInfo *message_info)
+{
+     uint8_t payload[DOWNLINK_PAYLOAD_MAX_SIZE + 1];
+     uint16_t payload_len;
+
+     ARG_UNUSED(context);
+
+     if (otCoapMessageGetCode(message) != OT_COAP_CODE_PUT) {
+          printk("THREAD [ERROR]: Downlink handler - Unexpected CoAP code\r\n");
+          return;
+     }
+
+     payload_len = otMessageRead(message, otMessageGetOffset(message), payload, DOWNLINK_PAYLOAD_MAX_SIZE);
+     payload[payload_len] = '\0';
+
+     printk("THREAD [DEBBUG]: Downlink request received: %s\r\n", payload);
+
+     // Multicast group requests are non confirmable and not answered
+     if (otCoapMessageGetType(message) == OT_COAP_TYPE_CONFIRMABLE) {
+          downlink_response_send(message, message_info);
+     }
+
+     if (on_downlink_request != NULL) {
+          on_downlink_request(payload, payload_len);
+     }
+}
+
+/* Status changed on the server: fetch the new state by unicast when its version changed */
+static void notify_request_handler(void *context, otMessage *message,
+                      const otMessageInfo *message_info)
+{
+     char payload[sizeof(NOTIFY_VERSION_PREFIX) + 10];
+     uint16_t payload_len;
+     uint32_t version;
+
+     ARG_UNUSED(context);
+     ARG_UNUSED(message_info);
+
+     payload_len = otMessageRead(message, otMessageGetOffset(message), payload, sizeof(payload) - 1);
+     payload[payload_len] = '\0';
+
+     if (strncmp(payload, NOTIFY_VERSION_PREFIX, strlen(NOTIFY_VERSION_PREFIX)) != 0) {
+          return;
+     }
+
+     version = strtoul(payload + strlen(NOTIFY_VERSION_PREFIX), NULL, 10);
+     if (version == status_version) {
+          return;
+     }
+     if ((status_version != 0) && (version != status_version + 1)) {
+          printk("THREAD [DEBBUG]: %d status notifications missed\r\n", version - status_version - 1);
+     }
+     status_version = version;
+
+     if (server_discovery_is_attached()) {
+          k_work_submit(&ressources_status_work);
+     }
+}
+
+static void status_reply_handler(struct k_work *item)
+{
+     int result = atomic_get(&status_reply_result);
+
+     ARG_UNUSED(item);
+
+     if (result != 0) {
+          printk("THREAD [ERROR]: No status reply within %d ms\r\n", CONFIG_CLIENT_STATUS_REPLY_TIMEOUT_MS);
+     }
+     if (on_status_reply != NULL) {
+          on_status_reply(result, (result == 0) && atomic_get(&status_reply_changed));
+     }
 }
 
 static struct openthread_state_changed_cb ot_state_chaged_cb = {
      .state_changed_cb = on_thread_state_changed
 };
 
-static void submit_work_if_connected(struct k_work *work)
-{         
-     if (is_connected) {
-          k_work_submit(work);
-     } else {
-          printk("THREAD [ERROR]: Connection is broken \r\n");
-     }
+void coap_client_status_reply_cb_set(status_reply_cb_t callback)
+{
+     on_status_reply = callback;
 }
 
-void coap_client_utils_init(ot_connection_cb_t on_connect, ot_disconnection_cb_t on_disconnect)
+uint32_t coap_client_device_hash(void)
 {
+     return server_discovery_device_hash();
+}
 
-     coap_init(AF_INET6, NULL);
+void coap_client_utils_init(ot_connection_cb_t on_connect, ot_disconnection_cb_t on_disconnect)
+{
+     otError error;
 
      k_work_init(&on_connect_work, on_connect);
      k_work_init(&on_disconnect_work, on_disconnect);
-     k_work_init(&multicast_commands_work, send_commands_to_server_message);
+     k_work_init_delayable(&status_reply_work, status_reply_handler);
      k_work_init(&ressources_status_work, send_ressources_status_request);
      k_work_init(&send_alarm_work, send_alarm);
      k_work_init(&send_keep_alive_work, send_keep_alive);
      k_work_init(&wifi_status_work, send_wifi_status_request);
      k_work_init(&presence_status_work, send_presence_status_request);
 
+     openthread_api_mutex_lock(openthread_get_default_context());
+     server_discovery_init(openthread_get_default_instance());
+     error = otCoapStart(openthread_get_default_instance(), COAP_PORT);
+     openthread_api_mutex_unlock(openthread_get_default_context());
+
+     if (error != OT_ERROR_NONE) {
+          printk("THREAD [ERROR]: Cannot start CoAP, error: %d\r\n", error);
+     }
+     request_manager_init();
+
      openthread_state_changed_cb_register(openthread_get_default_context(), &ot_state_chaged_cb);
      openthread_start(openthread_get_default_context());
 }
 
+int coap_client_downlink_init(downlink_request_cb_t callback)
+{
+     otInstance *ot = openthread_get_default_instance();
+
+     on_downlink_request = callback;
+
+     openthread_api_mutex_lock(openthread_get_default_context());
+
+     downlink_resource.mContext = ot;
+     downlink_resource.mHandler = downlink_request_handler;
+     otCoapAddResource(ot, &downlink_resource);
+
+     notify_resource.mContext = ot;
+     notify_resource.mHandler = notify_request_handler;
+     otCoapAddResource(ot, &notify_resource);
+
+     openthread_api_mutex_unlock(openthread_get_default_context());
+
+     return 0;
+}
+
 void coap_client_send_commands_to_server_message(uint8_t* msg, uint16_t msg_length)
 {    
-     msg_len = msg_length;
-     // copy message to send to buffer
-     for( int i =0; i < msg_length; i++ ){
-          msg_buf[i] = msg[i];
-     }     
-     submit_work_if_connected(&multicast_commands_work);
+     if (!server_discovery_is_attached()) {
+          offline_queue_push(OFFLINE_PRIORITY_COMMAND, OT_COAP_CODE_PUT, COMMANDS_URI_PATH, msg, msg_length,
+                         on_commands_msg_reply);
+          return;
+     }
+
+     printk("THREAD [DEBBUG]: Sending command to server \r\n");
+
+     // The request manager keeps its own copy of the payload
+     server_request_send(OT_COAP_CODE_PUT, COMMANDS_URI_PATH, msg, msg_length, on_commands_msg_reply);
+     dk_set_led_on(COMMANDS_MSG_LED);
 }
 
 void coap_client_send_ressources_status_request(void)
 {
-     submit_work_if_connected(&ressources_status_work);
+     server_work_submit_or_queue(&ressources_status_work, OFFLINE_PRIORITY_STATUS, OT_COAP_CODE_GET, RESSOURCES_URI_PATH,
+                                 NULL, 0u, on_ressource_status_reply);
 }
 
 void coap_client_send_alarm(void)
 {
-     submit_work_if_connected(&send_alarm_work);
+     server_work_submit_or_queue(&send_alarm_work, OFFLINE_PRIORITY_ALARM, OT_COAP_CODE_PUT, COMMANDS_URI_PATH,
+                                 (const uint8_t *)CMD1, sizeof(CMD1), on_commands_msg_reply);
 }
 
 void coap_client_send_keep_alive(void)
 {
-     submit_work_if_connected(&send_keep_alive_work);
+     atomic_val_t requests = server_requests_count();
+
+     // The requests sent to the server during the last period already prove this node is alive
+     if ((requests != server_requests_at_keep_alive) && (keep_alives_skipped < CONFIG_CLIENT_KEEP_ALIVE_SKIP_MAX)) {
+          server_requests_at_keep_alive = requests;
+          keep_alives_skipped ++;
+          keep_alives_suppressed ++;
+          printk("THREAD [DEBBUG]: Keep alive suppressed (sent: %d suppressed: %d)\r\n",
+                 keep_alives_sent, keep_alives_suppressed);
+          return;
+     }
+
+     // Not counting the keep alive msg itself
+     server_requests_at_keep_alive = requests + 1;
+     keep_alives_skipped = 0;
+     keep_alives_sent ++;
+
+     server_work_submit_or_queue(&send_keep_alive_work, OFFLINE_PRIORITY_KEEP_ALIVE, OT_COAP_CODE_PUT, COMMANDS_URI_PATH,
+                                 (const uint8_t *)KEEP_ALIVE_DEVICE_ID_2, sizeof(KEEP_ALIVE_DEVICE_ID_2), on_commands_msg_reply);
 }
 
 void coap_client_send_wifi_status_request(void)
 {
-     submit_work_if_connected(&wifi_status_work);
+     server_work_submit_or_queue(&wifi_status_work, OFFLINE_PRIORITY_STATUS, OT_COAP_CODE_GET, WIFI_URI_PATH,
+                                 NULL, 0u, on_ressource_status_reply);
 }
 
 void coap_client_send_presence_status_request(void)
 {
-     submit_work_if_connected(&presence_status_work);
+     server_work_submit_or_queue(&presence_status_work, OFFLINE_PRIORITY_STATUS, OT_COAP_CODE_GET, PRESENCE_URI_PATH,
+                                 NULL, 0u, on_ressource_status_reply);
 }
 
 void print_orchestrator_server_ressources(void){
@@ -7,80 +7,69 @@
 #include <zephyr/kernel.h>
 #include <thread_dongle_interface.h>
 #include <dk_buttons_and_leds.h>
-#include <net/coap_utils.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/net/openthread.h>
-#include <zephyr/net/socket.h>
 #include <openthread/thread.h>
+#include <openthread/coap.h>
+#include <stdlib.h>
 
 #include "coap_client_utils.h"
+#include "coap_request_manager.h"
+#include "offline_queue.h"
+#include "server_discovery.h"
 
-static bool is_connected;
 
-static struct k_work multicast_commands_work;
 static struct k_work send_keep_alive_work;
 static struct k_work on_connect_work;
 static struct k_work on_disconnect_work;
 
-uint16_t cmd_to_send_nb = 0;
+/* Requests sent to the server, a keep alive msg is only needed after a silent period */
+static atomic_val_t server_requests_at_keep_alive;
+static uint8_t keep_alives_skipped = CONFIG_CLIENT_KEEP_ALIVE_SKIP_MAX;
+static uint32_t keep_alives_sent;
+static uint32_t keep_alives_suppressed;
 
-/* Options supported by the server */
-static const char *const commands_option[] = { COMMANDS_URI_PATH, NULL };
-
-/* Thread multicast mesh local address */
-static struct sockaddr_in6 multicast_local_addr = {
-     .sin6_family = AF_INET6,
-     .sin6_port = htons(COAP_PORT),
-     .sin6_addr.s6_addr = { 0xff, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 },
-     .sin6_scope_id = 0U
-};
-
-static int on_commands_msg_reply(const struct coap_packet *response,
-                     struct coap_reply *reply,
-                     const struct sockaddr *from)
+static void on_commands_msg_reply(int result, const uint8_t *payload, uint16_t payload_size,
+                                  const otIp6Address *from)
 {
-     ARG_UNUSED(reply);
-     ARG_UNUSED(from);   
-
-     const uint8_t *payload;
-     uint16_t payload_size = 0u; 
-     char *cmd_ok = "CMD:OK";
+     char *cmd_ok = COMMANDS_OK;
 
      dk_set_led_off(RESSOURCES_STATUS_MSG_LED);
 
-     payload = coap_packet_get_payload(response, &payload_size);
+     if (result != 0) {
+          return;
+     }
+     server_reply_received(from);
+
+     if (payload == NULL) {
+          return;
+     }
 
      // Check if CMD:OK in payload
      if (strstr(payload, cmd_ok) != NULL) {
           printk("THREAD [DEBBUG]: commands msg reply: CMD_ACK\r\n"); 
           dk_set_led_off(COMMANDS_MSG_LED);     
-     }
-exit:
-     return 0;
-}
 
+          // Gateway latency sent by the server once the gateway acknowledged the command
+          char* latency_in_payload = strstr(payload, COMMANDS_LATENCY);
+          if (latency_in_payload != NULL) {
+               printk("THREAD [DEBBUG]: command acknowledged by gateway, latency: %d ms\r\n",
+                      atoi(latency_in_payload + strlen(COMMANDS_LATENCY)));
+          }
+     }
 
-static void send_commands_to_server_message(struct k_work *item)
-{
-     ARG_UNUSED(item);
-
-     printk("THREAD [DEBBUG]: Sending command to server \r\n");
-     
-     uint8_t msg_buf[] = "cmd_X ";
-     uint16_t msg_len = 6;
-     msg_buf[4] = cmd_to_send_nb + '0';     
+     // Check if CMD:TIMEOUT in payload
+     if (strstr(payload, COMMANDS_TIMEOUT) != NULL) {
+          printk("THREAD [ERROR]: command not acknowledged by gateway\r\n");
+     }
 
-     int ret_coap_req = coap_send_request(
-          COAP_METHOD_PUT,(const struct sockaddr *)&multicast_local_addr,
-          commands_option, &msg_buf, msg_len, on_commands_msg_reply);
-     
-     dk_set_led_on(COMMANDS_MSG_LED);
-     
-     // Clear variable
-     cmd_to_send_nb = 0; 
+     // Check if CMD:ERROR in payload
+     if (strstr(payload, COMMANDS_ERROR) != NULL) {
+          printk("THREAD [ERROR]: command not forwarded to the gateway\r\n");
+     }
 }
 
+
 static void send_keep_alive(struct k_work *item)
 {
      ARG_UNUSED(item);
@@ -90,57 +79,76 @@ static void send_keep_alive(struct k_work *item)
      static uint8_t msg_buf[] = KEEP_ALIVE_DEVICE_ID_3;
      uint16_t msg_len = sizeof(msg_buf);
 
-     int ret_coap_req = coap_send_request(
-          COAP_METHOD_PUT,(const struct sockaddr *)&multicast_local_addr,
-          commands_option, &msg_buf, msg_len, on_commands_msg_reply);
+     int ret_coap_req = server_request_send(OT_COAP_CODE_PUT, COMMANDS_URI_PATH, msg_buf, msg_len, on_commands_msg_reply);
      
      dk_set_led_on(COMMANDS_MSG_LED);
 }
+
 static void on_thread_state_changed(otChangedFlags flags, struct openthread_context *ot_context,
                         void *user_data)
 {
+     bool attached = false;
+
      if (flags & OT_CHANGED_THREAD_ROLE) {
           switch (otThreadGetDeviceRole(ot_context->instance)) {
           case OT_DEVICE_ROLE_CHILD:
           case OT_DEVICE_ROLE_ROUTER:
           case OT_DEVICE_ROLE_LEADER:
+               if (server_discovery_attached()) {
+                    attached = true;
+                    // The server learns the address of this node from its keep alive msgs
+                    keep_alives_skipped = CONFIG_CLIENT_KEEP_ALIVE_SKIP_MAX;
+               }
                k_work_submit(&on_connect_work);
-               is_connected = true;
                break;
 
           case OT_DEVICE_ROLE_DISABLED:
           case OT_DEVICE_ROLE_DETACHED:
           default:
+               server_discovery_detached();
                k_work_submit(&on_disconnect_work);
-               is_connected = false;
                break;
           }
      }
+
+     // Resolve the server once attached and whenever the network data changes
+     if ((flags & (OT_CHANGED_THREAD_ROLE | OT_CHANGED_THREAD_NETDATA)) && server_discovery_is_attached()) {
+          server_discovery_resolve(ot_context->instance);
+     }
+
+     // Requests made while detached, sent once the server is resolved
+     if (attached) {
+          offline_queue_flush(server_offline_request_send);
+     }
 }
 
 static struct openthread_state_changed_cb ot_state_chaged_cb = {
      .state_changed_cb = on_thread_state_changed
 };
 
-static void submit_work_if_connected(struct k_work *work)
-{         
-     if (is_connected) {
-          k_work_submit(work);
-     } else {
-          printk("THREAD [ERROR]: Connection is broken \r\n");
-     }
+uint32_t coap_client_device_hash(void)
+{
+     return server_discovery_device_hash();
 }
 
 void coap_client_utils_init(ot_connection_cb_t on_connect, ot_disconnection_cb_t on_disconnect)
 {
-
-     coap_init(AF_INET6, NULL);
+     otError error;
 
      k_work_init(&on_connect_work, on_connect);
      k_work_init(&on_disconnect_work, on_disconnect);
-     k_work_init(&multicast_commands_work, send_commands_to_server_message);
      k_work_init(&send_keep_alive_work, send_keep_alive);
 
+     openthread_api_mutex_lock(openthread_get_default_context());
+     server_discovery_init(openthread_get_default_instance());
+     error = otCoapStart(openthread_get_default_instance(), COAP_PORT);
+     openthread_api_mutex_unlock(openthread_get_default_context());
+
+     if (error != OT_ERROR_NONE) {
+          printk("THREAD [ERROR]: Cannot start CoAP, error: %d\r\n", error);
+     }
+     request_manager_init();
+
      openthread_state_changed_cb_register(openthread_get_default_context(), &ot_state_chaged_cb);
      openthread_start(openthread_get_default_context());
 }
@@ -149,12 +157,39 @@ void coap_client_send_command_to_server_message(uint16_t cmd_number){
 
      printk("THREAD [DEBBUG]: Sending command %d to server \r\n", cmd_number); 
 
-     cmd_to_send_nb = cmd_number;
-      
-     submit_work_if_connected(&multicast_commands_work);
+     uint8_t msg_buf[] = "cmd_X ";
+     uint16_t msg_len = 6;
+     msg_buf[4] = cmd_number + '0';
+
+     if (!server_discovery_is_attached()) {
+          offline_queue_push(OFFLINE_PRIORITY_COMMAND, OT_COAP_CODE_PUT, COMMANDS_URI_PATH, msg_buf, msg_len,
+                         on_commands_msg_reply);
+          return;
+     }
+
+     server_request_send(OT_COAP_CODE_PUT, COMMANDS_URI_PATH, msg_buf, msg_len, on_commands_msg_reply);
+     dk_set_led_on(COMMANDS_MSG_LED);
 }
 
 void coap_client_send_keep_alive(void)
 {
-     submit_work_if_connected(&send_keep_alive_work);
+     atomic_val_t requests = server_requests_count();
+
+     // The requests sent to the server during the last period already prove this node is alive
+     if ((requests != server_requests_at_keep_alive) && (keep_alives_skipped < CONFIG_CLIENT_KEEP_ALIVE_SKIP_MAX)) {
+          server_requests_at_keep_alive = requests;
+          keep_alives_skipped ++;
+          keep_alives_suppressed ++;
+          printk("THREAD [DEBBUG]: Keep alive suppressed (sent: %d suppressed: %d)\r\n",
+                 keep_alives_sent, keep_alives_suppressed);
+          return;
+     }
+
+     // Not counting the keep alive msg itself
+     server_requests_at_keep_alive = requests + 1;
+     keep_alives_skipped = 0;
+     keep_alives_sent ++;
+
+     server_work_submit_or_queue(&send_keep_alive_work, OFFLINE_PRIORITY_KEEP_ALIVE, OT_COAP_CODE_PUT, COMMANDS_URI_PATH,
+                                 (const uint8_t *)KEEP_ALIVE_DEVICE_ID_3, sizeof(KEEP_ALIVE_DEVICE_ID_3), on_commands_msg_reply);
 }
\ No newline at end of file
@@ -36,6 +36,11 @@ void coap_client_utils_init(ot_connection_cb_t on_connect,
  */
 void coap_client_send_keep_alive(void);
 
+/** @brief Returns a hash of the EUI-64 of this node, valid once the CoAP client
+ *         utilities are initialized.
+ */
+uint32_t coap_client_device_hash(void);
+
 /** @brief Send a action to the CoAP server node.
  *
  * @note The CoAP server should be paired before to have an affect.
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <string.h>
+
+#include "keys_debounce.h"
+
+bool keys_debounce_bit_get(const uint32_t *keys, uint16_t key)
+{
+     return (keys[key / 32] & (1UL << (key % 32))) != 0;
+}
+
+void keys_debounce_bit_set(uint32_t *keys, uint16_t key, bool value)
+{
+     if (value) {
+          keys[key / 32] |= (1UL << (key % 32));
+     } else {
+          keys[key / 32] &= ~(1UL << (key % 32));
+     }
+}
+
+void keys_debounce_init(struct keys_debounce *debounce, uint16_t keys_count, uint32_t debounce_ms,
+                        uint32_t *state, uint32_t *read, uint32_t *read_time, keys_debounce_cb_t on_change)
+{
+     debounce->keys_count = keys_count;
+     debounce->debounce_ms = debounce_ms;
+     debounce->state = state;
+     debounce->read = read;
+     debounce->read_time = read_time;
+     debounce->on_change = on_change;
+
+     memset(state, 0, KEYS_DEBOUNCE_WORDS(keys_count) * sizeof(uint32_t));
+     memset(read, 0, KEYS_DEBOUNCE_WORDS(keys_count) * sizeof(uint32_t));
+     memset(read_time, 0, keys_count * sizeof(uint32_t));
+}
+
+bool keys_debounce_update(struct keys_debounce *debounce, const uint32_t *keys, uint32_t now_ms)
+{
+     bool active = false;
+
+     for (uint16_t key = 0; key < debounce->keys_count; key++) {
+          bool pressed = keys_debounce_bit_get(keys, key);
+
+          if (pressed != keys_debounce_bit_get(debounce->read, key)) {
+               keys_debounce_bit_set(debounce->read, key, pressed);
+               debounce->read_time[key] = now_ms;
+          }
+
+          // Unsigned difference, right across a wrap around of the time
+          if ((pressed != keys_debounce_bit_get(debounce->state, key)) &&
+              (now_ms - debounce->read_time[key] >= debounce->debounce_ms)) {
+               keys_debounce_bit_set(debounce->state, key, pressed);
+               if (debounce->on_change != NULL) {
+                    debounce->on_change(key, pressed, debounce->read_time[key]);
+               }
+          }
+
+          active = active || pressed || (pressed != keys_debounce_bit_get(debounce->state, key));
+     }
+     return active;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file
+ * @defgroup keys_debounce Keys debounce, independent of the hardware
+ * @{
+ */
+
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __KEYS_DEBOUNCE_H__
+#define __KEYS_DEBOUNCE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Number of 32 bits words of a keys bitmap, bit key % 32 of word key / 32 per key */
+#define KEYS_DEBOUNCE_WORDS(keys_count) (((keys_count) + 31) / 32)
+
+/** @brief Type indicates function called for each debounced key change.
+ *
+ * @param[in] key     key number.
+ * @param[in] pressed new state of the key.
+ * @param[in] time_ms time the change was first read.
+ */
+typedef void (*keys_debounce_cb_t)(uint16_t key, bool pressed, uint32_t time_ms);
+
+/* Debounce state, the arrays are provided by the caller */
+struct keys_debounce {
+     uint16_t keys_count;
+     uint32_t debounce_ms;
+     // Debounced and last read states, KEYS_DEBOUNCE_WORDS(keys_count) words each
+     uint32_t *state;
+     uint32_t *read;
+     // Time of the last change read for each key, keys_count entries
+     uint32_t *read_time;
+     keys_debounce_cb_t on_change;
+};
+
+/** @brief Initialize a debounce state, all the keys released.
+ *
+ * @param[out] debounce    state to initialize.
+ * @param[in]  keys_count  number of keys.
+ * @param[in]  debounce_ms time a key must read the same way before its change is reported.
+ * @param[in]  state       KEYS_DEBOUNCE_WORDS(keys_count) words.
+ * @param[in]  read        KEYS_DEBOUNCE_WORDS(keys_count) words.
+ * @param[in]  read_time   keys_count entries.
+ * @param[in]  on_change   function called for each key change, may be NULL.
+ */
+void keys_debounce_init(struct keys_debounce *debounce, uint16_t keys_count, uint32_t debounce_ms,
+                        uint32_t *state, uint32_t *read, uint32_t *read_time, keys_debounce_cb_t on_change);
+
+/** @brief Update the keys states from a read.
+ *
+ * Each key is tracked on its own, so any number of keys may change at the
+ * same time. The times are compared by difference, so they may wrap around
+ * (e.g. k_uptime_get_32()).
+ *
+ * @param[in] debounce state to update.
+ * @param[in] keys     keys read, one bit per key.
+ * @param[in] now_ms   time of the read.
+ *
+ * @retval true while a key is pressed or not yet stable.
+ */
+bool keys_debounce_update(struct keys_debounce *debounce, const uint32_t *keys, uint32_t now_ms);
+
+/** @brief Returns the bit of a key in a keys bitmap.
+ */
+bool keys_debounce_bit_get(const uint32_t *keys, uint16_t key);
+
+/** @brief Sets the bit of a key in a keys bitmap.
+ */
+void keys_debounce_bit_set(uint32_t *keys, uint16_t key, bool value);
+
+#endif
+
+/**
+ * @}
+ */
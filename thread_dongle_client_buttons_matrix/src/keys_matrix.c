@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+
+#include "keys_debounce.h"
+#include "keys_matrix.h"
+
+#define MATRIX_NODE DT_PATH(zephyr_user)
+#define MATRIX_LINES DT_PROP_LEN(MATRIX_NODE, line_gpios)
+#define MATRIX_ROWS DT_PROP_LEN(MATRIX_NODE, row_gpios)
+#define MATRIX_KEYS (MATRIX_LINES * MATRIX_ROWS)
+#define MATRIX_WORDS KEYS_DEBOUNCE_WORDS(MATRIX_KEYS)
+
+#define LINE_SETTLE_TIME_US 10
+
+BUILD_ASSERT(MATRIX_KEYS <= UINT16_MAX, "Too many keys in the matrix");
+
+static const struct gpio_dt_spec lines[] = {
+     DT_FOREACH_PROP_ELEM_SEP(MATRIX_NODE, line_gpios, GPIO_DT_SPEC_GET_BY_IDX, (,))
+};
+
+static const struct gpio_dt_spec rows[] = {
+     DT_FOREACH_PROP_ELEM_SEP(MATRIX_NODE, row_gpios, GPIO_DT_SPEC_GET_BY_IDX, (,))
+};
+
+static struct gpio_callback rows_cb[MATRIX_ROWS];
+static struct k_work_delayable scan_work;
+static matrix_event_cb_t on_matrix_event;
+
+static struct keys_debounce keys_debounce;
+// Debounced and last read states, one bit per key
+static uint32_t keys_state[MATRIX_WORDS];
+static uint32_t keys_read[MATRIX_WORDS];
+// Time of the last change read for each key
+static uint32_t keys_read_time[MATRIX_KEYS];
+
+/* Drive the selected line low, or all the lines when selected_line is negative */
+static void lines_select(int selected_line)
+{
+     for (int i = 0; i < MATRIX_LINES; i++) {
+          bool selected = (selected_line < 0) || (selected_line == i);
+          gpio_pin_set_dt(&lines[i], selected ? 0 : 1);
+     }
+}
+
+static void rows_interrupt_enable(bool enable)
+{
+     for (int i = 0; i < MATRIX_ROWS; i++) {
+          gpio_pin_interrupt_configure_dt(&rows[i], enable ? GPIO_INT_EDGE_TO_ACTIVE : GPIO_INT_DISABLE);
+     }
+}
+
+static bool rows_active(void)
+{
+     for (int i = 0; i < MATRIX_ROWS; i++) {
+          if (gpio_pin_get_dt(&rows[i]) > 0) {
+               return true;
+          }
+     }
+     return false;
+}
+
+/* Read the keys pressed, one line at a time */
+static void matrix_read(uint32_t *keys)
+{
+     memset(keys, 0, MATRIX_WORDS * sizeof(uint32_t));
+
+     for (int line = 0; line < MATRIX_LINES; line++) {
+          lines_select(line);
+          k_busy_wait(LINE_SETTLE_TIME_US);
+          for (int row = 0; row < MATRIX_ROWS; row++) {
+               if (gpio_pin_get_dt(&rows[row]) > 0) {
+                    keys_debounce_bit_set(keys, row * MATRIX_LINES + line, true);
+               }
+          }
+     }
+}
+
+static void on_key_debounced(uint16_t key, bool pressed, uint32_t time_ms)
+{
+     struct matrix_event event = {
+          .time_ms = time_ms,
+          .key = key,
+          .pressed = pressed,
+     };
+
+     if (on_matrix_event != NULL) {
+          on_matrix_event(&event);
+     }
+}
+
+static void matrix_scan(struct k_work *item)
+{
+     uint32_t keys[MATRIX_WORDS];
+
+     ARG_UNUSED(item);
+
+     matrix_read(keys);
+     if (keys_debounce_update(&keys_debounce, keys, k_uptime_get_32())) {
+          k_work_schedule(&scan_work, K_MSEC(CONFIG_KEYS_MATRIX_SCAN_PERIOD_MS));
+          return;
+     }
+
+     // Sleep until a row goes active, unless a key was pressed meanwhile
+     lines_select(-1);
+     k_busy_wait(LINE_SETTLE_TIME_US);
+     rows_interrupt_enable(true);
+     if (rows_active()) {
+          rows_interrupt_enable(false);
+          k_work_schedule(&scan_work, K_NO_WAIT);
+     }
+}
+
+static void on_row_active(const struct device *port, struct gpio_callback *cb, gpio_port_pins_t pins)
+{
+     ARG_UNUSED(port);
+     ARG_UNUSED(cb);
+     ARG_UNUSED(pins);
+
+     // The lines are switched while scanning, the rows edges are meaningless until the keys are released
+     rows_interrupt_enable(false);
+     k_work_reschedule(&scan_work, K_NO_WAIT);
+}
+
+int keys_matrix_init(matrix_event_cb_t event_cb)
+{
+     int ret;
+
+     for (int i = 0; i < MATRIX_LINES; i++) {
+          if (!device_is_ready(lines[i].port)) {
+               return -ENODEV;
+          }
+          // Inactive is driven low, all the lines are selected
+          ret = gpio_pin_configure_dt(&lines[i], GPIO_OUTPUT_INACTIVE);
+          if (ret < 0) {
+               return ret;
+          }
+     }
+
+     for (int i = 0; i < MATRIX_ROWS; i++) {
+          if (!device_is_ready(rows[i].port)) {
+               return -ENODEV;
+          }
+          ret = gpio_pin_configure_dt(&rows[i], GPIO_INPUT);
+          if (ret < 0) {
+               return ret;
+          }
+          gpio_init_callback(&rows_cb[i], on_row_active, BIT(rows[i].pin));
+          ret = gpio_add_callback(rows[i].port, &rows_cb[i]);
+          if (ret < 0) {
+               return ret;
+          }
+     }
+
+     on_matrix_event = event_cb;
+     keys_debounce_init(&keys_debounce, MATRIX_KEYS, CONFIG_KEYS_MATRIX_DEBOUNCE_MS, keys_state, keys_read,
+                        keys_read_time, on_key_debounced);
+     k_work_init_delayable(&scan_work, matrix_scan);
+     rows_interrupt_enable(true);
+
+     printk("MATRIX [DEBBUG]: %d lines x %d rows keys matrix\r\n", MATRIX_LINES, MATRIX_ROWS);
+     return 0;
+}
+
+uint16_t keys_matrix_keys_count(void)
+{
+     return MATRIX_KEYS;
+}
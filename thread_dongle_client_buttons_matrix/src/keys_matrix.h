@@ -0,0 +1,61 @@
+/**
+ * @file
+ * @defgroup keys_matrix Keys matrix scanned on row interrupts
+ * @{
+ */
+
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __KEYS_MATRIX_H__
+#define __KEYS_MATRIX_H__
+
+#include <zephyr/kernel.h>
+
+/* Key change, key (line, row) is numbered row * lines count + line */
+struct matrix_event {
+     uint32_t time_ms;
+     uint16_t key;
+     bool pressed;
+};
+
+/** @brief Type indicates function called for each key change, from the system workqueue.
+ *
+ * @param[in] event key change, valid during the call only.
+ */
+typedef void (*matrix_event_cb_t)(const struct matrix_event *event);
+
+/** @brief Initialize the keys matrix.
+ *
+ * The lines and rows are the line-gpios and row-gpios of the zephyr,user
+ * devicetree node, in any number. A pressed key pulls its row active when its
+ * line is driven low. While idle all the lines are driven low and the rows raise
+ * an interrupt when they go active. The matrix is then scanned every
+ * CONFIG_KEYS_MATRIX_SCAN_PERIOD_MS until all the keys are released.
+ *
+ * Each key is tracked on its own and reported once stable for
+ * CONFIG_KEYS_MATRIX_DEBOUNCE_MS, so any number of keys may be pressed at the
+ * same time. The event time is the time the change was first read. Without a
+ * diode per key, three keys pressed on the corners of a rectangle also report
+ * the fourth one.
+ *
+ * @param[in] event_cb function called for each key change.
+ *
+ * @retval 0 on success.
+ * @retval -ENODEV if a line or row device is not ready.
+ * @retval other negative error code if a pin cannot be configured.
+ */
+int keys_matrix_init(matrix_event_cb_t event_cb);
+
+/** @brief Returns the number of keys of the matrix.
+ */
+uint16_t keys_matrix_keys_count(void);
+
+#endif
+
+/**
+ * @}
+ */
@@ -16,22 +16,14 @@
 #include <thread_dongle_interface.h>
 
 #include "coap_client_utils.h"
+#include "periodic_scheduler.h"
+#include "keys_matrix.h"
 
-// Buttons pressed check period
-#define BUTTONS_PRESS_PERIOD_MS    100
+#define KEY_LED_ON_PERIOD_MS       250
 #define KEEP_ALIVE_MSG_PERIOD_MS   10000
-#define TOGGLE_DEBOUNCE_PERIOD_MS  10
 
-// Setup for L1 and L2
-static const struct gpio_dt_spec line_1 = GPIO_DT_SPEC_GET(DT_ALIAS(line1), gpios);
-static const struct gpio_dt_spec line_2 = GPIO_DT_SPEC_GET(DT_ALIAS(line2), gpios);
-
-// Setup for L1 and L2
-static const struct gpio_dt_spec row_1 = GPIO_DT_SPEC_GET(DT_ALIAS(row1), gpios);
-static const struct gpio_dt_spec row_2 = GPIO_DT_SPEC_GET(DT_ALIAS(row2), gpios);
-
-bool l1_status = false;
-bool l2_status = false;
+static struct periodic_task keep_alive_task;
+static struct k_work_delayable key_led_work;
 
 static void on_ot_connect(struct k_work *item)
 {
@@ -46,105 +38,51 @@ static void on_ot_disconnect(struct k_work *item)
 }
 
 
-static void toggle_matrix_lines()
-{   
-    bool l1_old_status = l1_status;
-    bool l2_old_status = l2_status;
-    gpio_pin_set_dt(&line_1, l1_old_status? 1:0);
-    l1_status = !l1_old_status;
-    gpio_pin_set_dt(&line_2, l2_old_status? 1:0);
-    l2_status = !l2_old_status;
-    //printk("L1:%d  L2:%d \r\n",l1_status,l2_status);
-    k_msleep(TOGGLE_DEBOUNCE_PERIOD_MS);
-} 
-
-static void check_buttons()
-{     
-    bool row_1_status = gpio_pin_get_dt(&row_1);
-    bool row_2_status = gpio_pin_get_dt(&row_2);
-    
-    if(row_1_status){ 
-        dk_set_led_on(RESSOURCES_STATUS_MSG_LED); 
-        if (l1_status){
-            // S1 pressed
-            coap_client_send_command_to_server_message(1);
-        }
-        else{
-            // S2 pressed
-            coap_client_send_command_to_server_message(2);
-        }        
-        k_msleep(250);
-        dk_set_led_off(RESSOURCES_STATUS_MSG_LED); 
-        return;
-    }
-    if(row_2_status){ 
-        dk_set_led_on(RESSOURCES_STATUS_MSG_LED);         
-        if (l1_status){
-            // S3 pressed
-            coap_client_send_command_to_server_message(3);
-        }
-        else{
-            // S4 pressed
-            coap_client_send_command_to_server_message(4);
-        }        
-        k_msleep(250);
-        dk_set_led_off(RESSOURCES_STATUS_MSG_LED); 
+static void key_led_off(struct k_work *item)
+{
+    ARG_UNUSED(item);
+    dk_set_led_off(RESSOURCES_STATUS_MSG_LED);
+}
+
+static void on_matrix_event(const struct matrix_event *event)
+{
+    printk("MATRIX [DEBBUG]: S%d %s at %u ms\r\n", event->key + 1, event->pressed ? "pressed" : "released",
+           event->time_ms);
+    if (!event->pressed) {
         return;
     }
-} 
+
+    coap_client_send_command_to_server_message(event->key + 1);
+    printk("MATRIX [DEBBUG]: S%d command sent %d ms after the press\r\n", event->key + 1,
+           (int)(k_uptime_get_32() - event->time_ms));
+
+    dk_set_led_on(RESSOURCES_STATUS_MSG_LED);
+    k_work_reschedule(&key_led_work, K_MSEC(KEY_LED_ON_PERIOD_MS));
+}
 
 int main(void)
 {
-    int ret1;
-    int ret2;
-    
-    //Check if L1 L2, R1 and R2 are ready
-    if ((!device_is_ready(line_1.port)) && (!device_is_ready(line_2.port)) && (!device_is_ready(row_1.port)) && (!device_is_ready(row_2.port))){
-        printk("GPIO [ERROR]: Cannot configure devices\r\n");
-        return 0;
-    }
-
-    //Configure L1 and L2 as input/outputs
-    ret1 = gpio_pin_configure_dt(&line_1, GPIO_OUTPUT_ACTIVE);
-    ret2 = gpio_pin_configure_dt(&line_2, GPIO_OUTPUT_ACTIVE);
-    if ((ret1 < 0) && (ret2 < 0)) {
-        printk("GPIO [ERROR]: Cannot configure pins\r\n");
-        return 0;
-    }
+    int ret;
 
-    ret1 = dk_leds_init();
-    if (ret1) {
-        printk("LEDS [ERROR]: Cannot init leds, (error: %d)\r\n", ret1);
+    ret = dk_leds_init();
+    if (ret) {
+        printk("LEDS [ERROR]: Cannot init leds, (error: %d)\r\n", ret);
         return 0;
     }
 
-    // Configure R1 and R2 as inputs
-    ret1 = gpio_pin_configure_dt(&row_1, GPIO_INPUT);
-    ret2 = gpio_pin_configure_dt(&row_2, GPIO_INPUT);
-	if ((ret1 < 0) && (ret2 < 0)) {
-		return;
-	}
-
-    //Set L1(on) and L2(off) initial values
-    gpio_pin_set_dt(&line_1, 1);
-    gpio_pin_set_dt(&line_2, 0);
-    l1_status = false;
-    l2_status = true;
-
     // Init thread/coap
     coap_client_utils_init(on_ot_connect, on_ot_disconnect);   
 
-    int wait_loops_for_ka = KEEP_ALIVE_MSG_PERIOD_MS / BUTTONS_PRESS_PERIOD_MS;
-    int loops_count = 0;
-    while (1) {
-        k_msleep(BUTTONS_PRESS_PERIOD_MS);
-        toggle_matrix_lines();
-        check_buttons(); 
-        if (loops_count >=wait_loops_for_ka ){
-            coap_client_send_keep_alive();   
-            loops_count = 0;
-        } 
-        loops_count ++;
+    // Keep alive msgs with an offset and a jitter specific to this node
+    periodic_scheduler_init(coap_client_device_hash());
+    periodic_task_start(&keep_alive_task, KEEP_ALIVE_MSG_PERIOD_MS, coap_client_send_keep_alive);
+
+    // Send a command for each key pressed
+    k_work_init_delayable(&key_led_work, key_led_off);
+    ret = keys_matrix_init(on_matrix_event);
+    if (ret) {
+        printk("GPIO [ERROR]: Cannot init keys matrix (error: %d)\r\n", ret);
+        return 0;
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keys_debounce.h"
+
+#define KEYS_COUNT 40
+#define DEBOUNCE_MS 10
+#define SCAN_PERIOD_MS 5
+#define EVENTS_MAX 16
+
+#define ARRAY_LEN(array) ((int)(sizeof(array) / sizeof((array)[0])))
+
+struct key_event {
+     uint16_t key;
+     bool pressed;
+     uint32_t time_ms;
+};
+
+/* Keys read at a time, a key pressed per bit of the low word and the key 32 + n per bit of the high word */
+struct trace_read {
+     uint32_t time_ms;
+     uint32_t keys_low;
+     uint8_t keys_high;
+};
+
+static struct key_event events[EVENTS_MAX];
+static int events_count;
+static int failures;
+
+static void on_change(uint16_t key, bool pressed, uint32_t time_ms)
+{
+     if (events_count < EVENTS_MAX) {
+          events[events_count].key = key;
+          events[events_count].pressed = pressed;
+          events[events_count].time_ms = time_ms;
+     }
+     events_count++;
+}
+
+/* Feed a trace, starting at start_ms, and compare the events with the expected ones and the last active state */
+static void trace_check(const char *name, uint32_t start_ms, const struct trace_read *reads, int reads_count,
+                        const struct key_event *expected, int expected_count, bool expected_active)
+{
+     struct keys_debounce debounce;
+     uint32_t state[KEYS_DEBOUNCE_WORDS(KEYS_COUNT)];
+     uint32_t read[KEYS_DEBOUNCE_WORDS(KEYS_COUNT)];
+     uint32_t read_time[KEYS_COUNT];
+     bool active = false;
+     bool ok;
+
+     keys_debounce_init(&debounce, KEYS_COUNT, DEBOUNCE_MS, state, read, read_time, on_change);
+     events_count = 0;
+
+     for (int i = 0; i < reads_count; i++) {
+          uint32_t keys[KEYS_DEBOUNCE_WORDS(KEYS_COUNT)] = { reads[i].keys_low, reads[i].keys_high };
+
+          active = keys_debounce_update(&debounce, keys, start_ms + reads[i].time_ms);
+     }
+
+     ok = (events_count == expected_count) && (active == expected_active);
+     for (int i = 0; ok && (i < expected_count); i++) {
+          ok = (events[i].key == expected[i].key) && (events[i].pressed == expected[i].pressed) &&
+               (events[i].time_ms == start_ms + expected[i].time_ms);
+     }
+
+     printf("%s: %s\n", ok ? "PASS" : "FAIL", name);
+     if (!ok) {
+          for (int i = 0; (i < events_count) && (i < EVENTS_MAX); i++) {
+               printf("  key %d %s at %u\n", events[i].key, events[i].pressed ? "pressed" : "released",
+                      (unsigned)(events[i].time_ms - start_ms));
+          }
+          printf("  active %d\n", active);
+          failures++;
+     }
+}
+
+/* A key bouncing on press and on release, reported once each way at the time of its last change */
+static void bounce_test(uint32_t start_ms, const char *name)
+{
+     static const struct trace_read reads[] = {
+          {0, 0x0, 0}, {5, 0x1, 0}, {10, 0x0, 0}, {15, 0x1, 0}, {20, 0x1, 0},
+          {25, 0x1, 0}, {30, 0x1, 0}, {35, 0x0, 0}, {40, 0x1, 0}, {45, 0x0, 0},
+          {50, 0x0, 0}, {55, 0x0, 0}, {60, 0x0, 0},
+     };
+     static const struct key_event expected[] = {
+          {0, true, 15}, {0, false, 45},
+     };
+
+     trace_check(name, start_ms, reads, ARRAY_LEN(reads), expected, ARRAY_LEN(expected), false);
+}
+
+/* Several keys pressed and released overlapping, across both words, each reported on its own */
+static void rollover_test(void)
+{
+     static const struct trace_read reads[] = {
+          {0, 0x1, 0}, {5, 0x1, 0}, {10, 0x80000001, 0}, {15, 0x80000009, 0}, {20, 0x80000009, 0x2},
+          {25, 0x80000008, 0x2}, {30, 0x80000008, 0x2}, {35, 0x8, 0x2}, {40, 0x8, 0x2}, {45, 0x8, 0},
+          {50, 0x8, 0}, {55, 0x8, 0},
+     };
+     static const struct key_event expected[] = {
+          {0, true, 0}, {31, true, 10}, {3, true, 15}, {33, true, 20}, {0, false, 25},
+          {31, false, 35}, {33, false, 45},
+     };
+
+     trace_check("rollover", 0, reads, ARRAY_LEN(reads), expected, ARRAY_LEN(expected), true);
+}
+
+/* A change shorter than the debounce time is never reported */
+static void glitch_test(void)
+{
+     static const struct trace_read reads[] = {
+          {0, 0x2, 0}, {SCAN_PERIOD_MS, 0x0, 0}, {2 * SCAN_PERIOD_MS, 0x0, 0}, {3 * SCAN_PERIOD_MS, 0x0, 0},
+     };
+
+     trace_check("glitch", 0, reads, ARRAY_LEN(reads), NULL, 0, false);
+}
+
+int main(void)
+{
+     bounce_test(0, "bounce");
+     // The uptime in ms wraps around after 49 days, in the middle of the trace
+     bounce_test(UINT32_MAX - 20, "bounce across the time wrap around");
+     rollover_test();
+     glitch_test();
+
+     return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -26,11 +26,42 @@ typedef void (*ot_connection_cb_t)(struct k_work *item);
  */
 typedef void (*ot_disconnection_cb_t)(struct k_work *item);
 
+/** @brief Type indicates function called when a downlink request is received
+ *         from the CoAP server node.
+ *
+ * @param[in] payload NULL terminated request payload.
+ * @param[in] payload_len request payload length.
+ */
+typedef void (*downlink_request_cb_t)(const uint8_t *payload, uint16_t payload_len);
+
+/** @brief Type indicates function called when a periodic status request completes.
+ *
+ * @param[in] result 0 when the status was updated from the reply, -ETIMEDOUT
+ *                   when no reply arrived in time.
+ * @param[in] changed true if the reply changed the known status.
+ */
+typedef void (*status_reply_cb_t)(int result, bool changed);
+
 /** @brief Initialize CoAP client utilities.
  */
 void coap_client_utils_init(ot_connection_cb_t on_connect,
                    ot_disconnection_cb_t on_disconnect);
 
+/** @brief Set the function called from the system workqueue when a status request
+ *         completes, as soon as its reply arrives.
+ */
+void coap_client_status_reply_cb_set(status_reply_cb_t callback);
+
+/** @brief Returns a hash of the EUI-64 of this node, valid once the CoAP client
+ *         utilities are initialized.
+ */
+uint32_t coap_client_device_hash(void);
+
+/** @brief Expose the downlink resource used by the CoAP server node to send
+ *         requests and status change notifications to this client.
+ */
+int coap_client_downlink_init(downlink_request_cb_t on_downlink_request);
+
 /** @brief Send a action to the CoAP server node.
  *
  * @note The CoAP server should be paired before to have an affect.
@@ -0,0 +1,634 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <thread_dongle_interface.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/coap.h>
+#include <openthread/ip6.h>
+#include <openthread/message.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap_request_manager.h"
+
+// Callbacks of the requests coalesced with a queued or in flight GET
+#define REQUEST_COALESCED_MAX 2
+
+/* Retransmission timeout of the confirmable requests, CoCoA estimators
+ * RTO = SRTT + K * RTTVAR, K = 4 for the strong estimator (responses to the first transmission)
+ * and K = 1 for the weak one (responses after a retransmission, measured from the first transmission)
+ * The minimum is the smallest ACK timeout accepted by the OpenThread CoAP transmission parameters.
+ */
+#define RTO_INITIAL_MS 2000
+#define RTO_MIN_MS OT_COAP_MIN_ACK_TIMEOUT
+#define RTO_MAX_MS 60000
+#define RTO_STRONG_K 4
+#define RTO_WEAK_K 1
+#define RTO_MAX_RETRANSMIT 4
+
+struct rtt_estimator {
+     int32_t srtt;
+     int32_t rttvar;
+     int32_t rto;
+     uint32_t samples;
+};
+
+/* RTT estimates of a destination */
+struct rtt_entry {
+     bool in_use;
+     otIp6Address addr;
+     struct rtt_estimator strong;
+     struct rtt_estimator weak;
+     int32_t rto;
+     int64_t rto_update_time;
+     int64_t last_use_time;
+};
+
+enum request_state {
+     REQUEST_FREE,
+     REQUEST_QUEUED,
+     REQUEST_IN_FLIGHT,
+};
+
+struct request_slot {
+     enum request_state state;
+     uint16_t id;
+     uint32_t seq;
+     otCoapCode code;
+     otIp6Address addr;
+     uint16_t port;
+     const char *uri_path;
+     uint8_t payload[REQUEST_PAYLOAD_MAX_SIZE];
+     uint16_t payload_len;
+     request_done_cb_t done_cb[REQUEST_COALESCED_MAX];
+     uint8_t records;
+     int64_t deadline;
+     int64_t send_time;
+     int32_t ack_timeout;
+     uint8_t retransmits;
+};
+
+static struct request_slot request_slots[CONFIG_REQUEST_MANAGER_SLOTS];
+static struct k_spinlock request_slots_lock;
+static uint16_t next_request_id = 1;
+static uint32_t next_request_seq;
+static uint8_t requests_in_flight;
+
+static struct rtt_entry rtt_entries[CONFIG_REQUEST_MANAGER_RTT_DESTINATIONS];
+static struct k_spinlock rtt_lock;
+
+static struct k_work request_send_work;
+static struct k_work_delayable request_timeout_work;
+static atomic_t requests_timed_out = ATOMIC_INIT(0);
+static request_timeout_cb_t on_request_timeout;
+
+static bool addr_is_multicast(const otIp6Address *addr)
+{
+     return addr->mFields.m8[0] == 0xff;
+}
+
+/* Entry of a destination, the least recently used one is reused, must be called with the RTT lock held */
+static struct rtt_entry *rtt_entry_get(const otIp6Address *addr, int64_t now)
+{
+     struct rtt_entry *entry = &rtt_entries[0];
+
+     for (int i = 0; i < ARRAY_SIZE(rtt_entries); i++) {
+          if (rtt_entries[i].in_use && (memcmp(&rtt_entries[i].addr, addr, sizeof(otIp6Address)) == 0)) {
+               rtt_entries[i].last_use_time = now;
+               return &rtt_entries[i];
+          }
+          if (!rtt_entries[i].in_use ||
+              (entry->in_use && (rtt_entries[i].last_use_time < entry->last_use_time))) {
+               entry = &rtt_entries[i];
+          }
+     }
+
+     memset(entry, 0, sizeof(*entry));
+     entry->in_use = true;
+     entry->addr = *addr;
+     entry->rto = RTO_INITIAL_MS;
+     entry->rto_update_time = now;
+     entry->last_use_time = now;
+     return entry;
+}
+
+/* RFC 6298 smoothing of a RTT sample, returns the estimator RTO */
+static int32_t rtt_estimator_update(struct rtt_estimator *estimator, int32_t rtt, int32_t k)
+{
+     if (estimator->samples == 0) {
+          estimator->srtt = rtt;
+          estimator->rttvar = rtt / 2;
+     } else {
+          estimator->rttvar = (3 * estimator->rttvar + abs(estimator->srtt - rtt)) / 4;
+          estimator->srtt = (7 * estimator->srtt + rtt) / 8;
+     }
+     estimator->samples ++;
+     estimator->rto = CLAMP(estimator->srtt + k * estimator->rttvar, RTO_MIN_MS, RTO_MAX_MS);
+     return estimator->rto;
+}
+
+/* Update the RTO of a destination with the RTT of an exchange */
+static void rtt_sample_add(const otIp6Address *addr, int32_t rtt, bool retransmitted)
+{
+     int64_t now = k_uptime_get();
+
+     k_spinlock_key_t key = k_spin_lock(&rtt_lock);
+     struct rtt_entry *entry = rtt_entry_get(addr, now);
+     if (retransmitted) {
+          // The weak estimate weighs less, the response may answer any of the transmissions
+          int32_t rto_weak = rtt_estimator_update(&entry->weak, rtt, RTO_WEAK_K);
+          entry->rto = (rto_weak + 3 * entry->rto) / 4;
+     } else {
+          int32_t rto_strong = rtt_estimator_update(&entry->strong, rtt, RTO_STRONG_K);
+          entry->rto = (rto_strong + entry->rto) / 2;
+     }
+     entry->rto = CLAMP(entry->rto, RTO_MIN_MS, RTO_MAX_MS);
+     entry->rto_update_time = now;
+     k_spin_unlock(&rtt_lock, key);
+}
+
+/* RTO of a destination, aged when no estimate updated it for a while */
+static int32_t rtt_rto_get(const otIp6Address *addr)
+{
+     int64_t now = k_uptime_get();
+     int32_t rto;
+
+     k_spinlock_key_t key = k_spin_lock(&rtt_lock);
+     struct rtt_entry *entry = rtt_entry_get(addr, now);
+     int64_t idle = now - entry->rto_update_time;
+     if ((entry->rto < RTO_INITIAL_MS) && (idle > 16 * entry->rto)) {
+          // A small RTO may not hold anymore
+          entry->rto = MIN(2 * entry->rto, RTO_INITIAL_MS);
+          entry->rto_update_time = now;
+     } else if ((entry->rto > 3000) && (idle > 4 * entry->rto)) {
+          // A large RTO decays towards the initial one
+          entry->rto = (entry->rto + RTO_INITIAL_MS) / 2;
+          entry->rto_update_time = now;
+     }
+     rto = entry->rto;
+     k_spin_unlock(&rtt_lock, key);
+     return rto;
+}
+
+/* Free a slot and call the callbacks of its requests, the slot lock must not be held */
+static void request_complete(struct request_slot *slot, uint16_t id, int result, const uint8_t *payload,
+                       uint16_t payload_len, const otIp6Address *from)
+{
+     request_done_cb_t done_cb[REQUEST_COALESCED_MAX];
+     otIp6Address addr;
+
+     k_spinlock_key_t key = k_spin_lock(&request_slots_lock);
+     // Already completed by the response handler or the timeout
+     if ((slot->state == REQUEST_FREE) || (slot->id != id)) {
+          k_spin_unlock(&request_slots_lock, key);
+          return;
+     }
+     if (slot->state == REQUEST_IN_FLIGHT) {
+          requests_in_flight --;
+     }
+     memcpy(done_cb, slot->done_cb, sizeof(done_cb));
+     addr = slot->addr;
+     slot->state = REQUEST_FREE;
+     slot->id = 0;
+     k_spin_unlock(&request_slots_lock, key);
+
+     if ((result == -ETIMEDOUT) && (on_request_timeout != NULL)) {
+          on_request_timeout(&addr);
+     }
+
+     for (int i = 0; i < REQUEST_COALESCED_MAX; i++) {
+          if (done_cb[i] != NULL) {
+               done_cb[i](result, payload, payload_len, from);
+          }
+     }
+
+     // A slot of the in-flight window is free again
+     k_work_submit(&request_send_work);
+}
+
+static struct request_slot *request_find(uint16_t id)
+{
+     for (int i = 0; i < ARRAY_SIZE(request_slots); i++) {
+          if ((request_slots[i].state == REQUEST_IN_FLIGHT) && (request_slots[i].id == id)) {
+               return &request_slots[i];
+          }
+     }
+     return NULL;
+}
+
+static void request_response_handler(void *context, otMessage *message,
+                             const otMessageInfo *message_info, otError result)
+{
+     uint8_t payload[REQUEST_PAYLOAD_MAX_SIZE + 1];
+     uint16_t payload_len = 0;
+     uint16_t id = (uint16_t)(uintptr_t)context;
+     int64_t send_time = 0;
+     int32_t ack_timeout = 0;
+
+     k_spinlock_key_t key = k_spin_lock(&request_slots_lock);
+     struct request_slot *slot = request_find(id);
+     if (slot != NULL) {
+          send_time = slot->send_time;
+          ack_timeout = slot->ack_timeout;
+     }
+     k_spin_unlock(&request_slots_lock, key);
+
+     // Late response of a request already completed, or other responses to a multicast request
+     if (slot == NULL) {
+          return;
+     }
+
+     if (result != OT_ERROR_NONE) {
+          request_complete(slot, id, result == OT_ERROR_RESPONSE_TIMEOUT ? -ETIMEDOUT : -EIO, NULL, 0, NULL);
+          return;
+     }
+
+     // Only a piggybacked response measures the round trip, a separate one includes the server processing
+     if ((ack_timeout > 0) && (otCoapMessageGetType(message) == OT_COAP_TYPE_ACKNOWLEDGMENT)) {
+          int32_t rtt = (int32_t)(k_uptime_get() - send_time);
+          // The first timeout is exact, no random factor is left to OpenThread: a response
+          // later than it answers a retransmission
+          rtt_sample_add(&message_info->mPeerAddr, rtt, rtt >= ack_timeout);
+     }
+
+     payload_len = otMessageRead(message, otMessageGetOffset(message), payload, REQUEST_PAYLOAD_MAX_SIZE);
+     payload[payload_len] = '\0';
+
+     request_complete(slot, id, 0, payload_len > 0 ? payload : NULL, payload_len, &message_info->mPeerAddr);
+}
+
+static otError request_message_send(otInstance *ot, struct request_slot *slot)
+{
+     otError error = OT_ERROR_NO_BUFS;
+     otMessage *request;
+     otMessageInfo message_info;
+     otCoapTxParameters tx_parameters;
+     bool multicast = addr_is_multicast(&slot->addr);
+
+     memset(&message_info, 0, sizeof(message_info));
+     message_info.mPeerAddr = slot->addr;
+     message_info.mPeerPort = slot->port;
+
+     request = otCoapNewMessage(ot, NULL);
+     if (request == NULL) {
+          goto end;
+     }
+
+     // Multicast requests cannot be acknowledged
+     otCoapMessageInit(request, multicast ? OT_COAP_TYPE_NON_CONFIRMABLE : OT_COAP_TYPE_CONFIRMABLE,
+                   slot->code);
+     otCoapMessageGenerateToken(request, OT_COAP_DEFAULT_TOKEN_LENGTH);
+
+     error = otCoapMessageAppendUriPathOptions(request, slot->uri_path);
+     if (error != OT_ERROR_NONE) {
+          goto end;
+     }
+
+     if (slot->payload_len > 0) {
+          error = otCoapMessageSetPayloadMarker(request);
+          if (error != OT_ERROR_NONE) {
+               goto end;
+          }
+
+          error = otMessageAppend(request, slot->payload, slot->payload_len);
+          if (error != OT_ERROR_NONE) {
+               goto end;
+          }
+     }
+
+     if (multicast) {
+          error = otCoapSendRequest(ot, request, &message_info, request_response_handler,
+                              (void *)(uintptr_t)slot->id);
+     } else {
+          // First timeout already randomized, then doubled at each retransmission
+          tx_parameters.mAckTimeout = slot->ack_timeout;
+          tx_parameters.mAckRandomFactorNumerator = 1;
+          tx_parameters.mAckRandomFactorDenominator = 1;
+          tx_parameters.mMaxRetransmit = slot->retransmits;
+          error = otCoapSendRequestWithParameters(ot, request, &message_info, request_response_handler,
+                                          (void *)(uintptr_t)slot->id, &tx_parameters);
+     }
+
+end:
+     if (error != OT_ERROR_NONE && request != NULL) {
+          otMessageFree(request);
+     }
+     return error;
+}
+
+/* Oldest queued request, must be called with the slot lock held */
+static struct request_slot *request_next_queued(void)
+{
+     struct request_slot *next = NULL;
+
+     for (int i = 0; i < ARRAY_SIZE(request_slots); i++) {
+          if ((request_slots[i].state == REQUEST_QUEUED) &&
+              ((next == NULL) || ((int32_t)(request_slots[i].seq - next->seq) < 0))) {
+               next = &request_slots[i];
+          }
+     }
+     return next;
+}
+
+/* Draw the first ACK timeout in [RTO, 1.5 * RTO], the CoAP random factor, and keep the retransmissions
+ * that fit in CONFIG_REQUEST_MANAGER_EXCHANGE_MAX_MS. Returns the lifetime of the exchange, the first
+ * timeout being doubled at each retransmission: ack_timeout * (2^(retransmits + 1) - 1)
+ */
+static int64_t request_exchange_plan(int32_t rto, int32_t *ack_timeout, uint8_t *retransmits)
+{
+     int32_t timeout = rto + k_cycle_get_32() % (rto / 2 + 1);
+     uint8_t count = 0;
+
+     timeout = MAX(MIN(timeout, CONFIG_REQUEST_MANAGER_EXCHANGE_MAX_MS), RTO_MIN_MS);
+     while ((count < RTO_MAX_RETRANSMIT) &&
+            ((int64_t)timeout * ((1 << (count + 2)) - 1) <= CONFIG_REQUEST_MANAGER_EXCHANGE_MAX_MS)) {
+          count ++;
+     }
+
+     *ack_timeout = timeout;
+     *retransmits = count;
+     return (int64_t)timeout * ((1 << (count + 1)) - 1);
+}
+
+/* Arm the timeout work for a request, ahead of its pending expiry when the request is due earlier */
+static void request_timeout_arm(int64_t timeout)
+{
+     if (k_work_delayable_is_pending(&request_timeout_work) &&
+         (k_ticks_to_ms_ceil64(k_work_delayable_remaining_get(&request_timeout_work)) <= timeout)) {
+          return;
+     }
+     k_work_reschedule(&request_timeout_work, K_MSEC(timeout));
+}
+
+/* Send the queued requests while the in-flight window allows it */
+static void request_send_handler(struct k_work *item)
+{
+     otInstance *ot = openthread_get_default_instance();
+
+     ARG_UNUSED(item);
+
+     while (true) {
+          k_spinlock_key_t key = k_spin_lock(&request_slots_lock);
+          struct request_slot *slot = NULL;
+          uint16_t id = 0;
+          if (requests_in_flight < CONFIG_REQUEST_MANAGER_WINDOW) {
+               slot = request_next_queued();
+          }
+          if (slot != NULL) {
+               id = slot->id;
+               slot->state = REQUEST_IN_FLIGHT;
+               requests_in_flight ++;
+          }
+          k_spin_unlock(&request_slots_lock, key);
+
+          if (slot == NULL) {
+               break;
+          }
+
+          int32_t ack_timeout = 0;
+          uint8_t retransmits = 0;
+          int64_t timeout = CONFIG_REQUEST_MANAGER_TIMEOUT_MS;
+          if (!addr_is_multicast(&slot->addr)) {
+               // A request to an unreachable server holds its slot of the window for a bounded time
+               timeout = request_exchange_plan(rtt_rto_get(&slot->addr), &ack_timeout, &retransmits);
+          }
+
+          key = k_spin_lock(&request_slots_lock);
+          if (slot->id == id) {
+               slot->ack_timeout = ack_timeout;
+               slot->retransmits = retransmits;
+               slot->send_time = k_uptime_get();
+               slot->deadline = slot->send_time + timeout;
+          }
+          k_spin_unlock(&request_slots_lock, key);
+
+          openthread_api_mutex_lock(openthread_get_default_context());
+          otError error = request_message_send(ot, slot);
+          openthread_api_mutex_unlock(openthread_get_default_context());
+
+          if (error != OT_ERROR_NONE) {
+               printk("THREAD [ERROR]: Cannot send request to /%s, error: %d\r\n", slot->uri_path, error);
+               request_complete(slot, id, -EIO, NULL, 0, NULL);
+               continue;
+          }
+
+          request_timeout_arm(timeout);
+     }
+}
+
+/* Complete the requests without response in time */
+static void request_timeout_handler(struct k_work *item)
+{
+     int64_t now = k_uptime_get();
+     int64_t next_deadline = INT64_MAX;
+
+     ARG_UNUSED(item);
+
+     for (int i = 0; i < ARRAY_SIZE(request_slots); i++) {
+          struct request_slot *slot = &request_slots[i];
+
+          k_spinlock_key_t key = k_spin_lock(&request_slots_lock);
+          uint16_t id = slot->id;
+          bool expired = (slot->state == REQUEST_IN_FLIGHT) && (slot->deadline <= now);
+          if ((slot->state == REQUEST_IN_FLIGHT) && !expired) {
+               next_deadline = MIN(next_deadline, slot->deadline);
+          }
+          k_spin_unlock(&request_slots_lock, key);
+
+          if (expired) {
+               printk("THREAD [ERROR]: Request to /%s timed out\r\n", slot->uri_path);
+               atomic_inc(&requests_timed_out);
+               request_complete(slot, id, -ETIMEDOUT, NULL, 0, NULL);
+          }
+     }
+
+     if (next_deadline != INT64_MAX) {
+          request_timeout_arm(next_deadline - now);
+     }
+}
+
+/* Add the callback of a request to a slot, must be called with the slot lock held */
+static bool request_done_cb_add(struct request_slot *slot, request_done_cb_t done_cb)
+{
+     for (int j = 0; j < REQUEST_COALESCED_MAX; j++) {
+          if ((slot->done_cb[j] == done_cb) || (slot->done_cb[j] == NULL)) {
+               slot->done_cb[j] = done_cb;
+               return true;
+          }
+     }
+     return false;
+}
+
+/* Add the callback to a GET already queued or in flight, must be called with the slot lock held */
+static bool request_coalesce(const otIp6Address *addr, uint16_t port, const char *uri_path,
+                       request_done_cb_t done_cb)
+{
+     for (int i = 0; i < ARRAY_SIZE(request_slots); i++) {
+          struct request_slot *slot = &request_slots[i];
+
+          if ((slot->state == REQUEST_FREE) || (slot->code != OT_COAP_CODE_GET) ||
+              (strcmp(slot->uri_path, uri_path) != 0) ||
+              (memcmp(&slot->addr, addr, sizeof(otIp6Address)) != 0) || (slot->port != port)) {
+               continue;
+          }
+
+          if (request_done_cb_add(slot, done_cb)) {
+               return true;
+          }
+     }
+     return false;
+}
+
+/* Append a command to a commands PUT still queued: cmd;cmd;...
+ * must be called with the slot lock held
+ */
+static struct request_slot *request_batch(const otIp6Address *addr, uint16_t port, const uint8_t *payload,
+                                  uint16_t payload_len, request_done_cb_t done_cb)
+{
+     // Commands sent by the clients can be NULL terminated
+     uint16_t record_len = strnlen((const char *)payload, payload_len);
+
+     if (record_len == 0) {
+          return NULL;
+     }
+
+     for (int i = 0; i < ARRAY_SIZE(request_slots); i++) {
+          struct request_slot *slot = &request_slots[i];
+          uint16_t batch_len = strnlen((const char *)slot->payload, slot->payload_len);
+
+          if ((slot->state != REQUEST_QUEUED) || (slot->code != OT_COAP_CODE_PUT) ||
+              (strcmp(slot->uri_path, COMMANDS_URI_PATH) != 0) ||
+              (memcmp(&slot->addr, addr, sizeof(otIp6Address)) != 0) || (slot->port != port) ||
+              (batch_len + 1 + record_len > REQUEST_PAYLOAD_MAX_SIZE) || !request_done_cb_add(slot, done_cb)) {
+               continue;
+          }
+
+          slot->payload[batch_len] = COMMANDS_RECORD_SEPARATOR;
+          memcpy(&slot->payload[batch_len + 1], payload, record_len);
+          slot->payload_len = batch_len + 1 + record_len;
+          slot->records ++;
+          return slot;
+     }
+     return NULL;
+}
+
+int request_manager_send_to(otCoapCode code, const otIp6Address *addr, uint16_t port, const char *uri_path,
+                      const uint8_t *payload, uint16_t payload_len, request_done_cb_t done_cb)
+{
+     struct request_slot *slot = NULL;
+
+     if (payload_len > REQUEST_PAYLOAD_MAX_SIZE) {
+          return -EMSGSIZE;
+     }
+
+     k_spinlock_key_t key = k_spin_lock(&request_slots_lock);
+
+     if ((code == OT_COAP_CODE_GET) && request_coalesce(addr, port, uri_path, done_cb)) {
+          k_spin_unlock(&request_slots_lock, key);
+          printk("THREAD [DEBBUG]: Request to /%s coalesced with the pending one\r\n", uri_path);
+          return 0;
+     }
+
+     if (IS_ENABLED(CONFIG_REQUEST_MANAGER_COMMANDS_BATCHING) && (code == OT_COAP_CODE_PUT) &&
+         (strcmp(uri_path, COMMANDS_URI_PATH) == 0)) {
+          slot = request_batch(addr, port, payload, payload_len, done_cb);
+          if (slot != NULL) {
+               uint8_t records = slot->records;
+               k_spin_unlock(&request_slots_lock, key);
+               printk("THREAD [DEBBUG]: Command batched with the queued ones (%d records)\r\n", records);
+               return 0;
+          }
+     }
+
+     for (int i = 0; i < ARRAY_SIZE(request_slots); i++) {
+          if (request_slots[i].state == REQUEST_FREE) {
+               slot = &request_slots[i];
+               break;
+          }
+     }
+     if (slot == NULL) {
+          k_spin_unlock(&request_slots_lock, key);
+          return -ENOMEM;
+     }
+
+     memset(slot, 0, sizeof(*slot));
+     slot->state = REQUEST_QUEUED;
+     slot->id = next_request_id++;
+     if (next_request_id == 0) {
+          next_request_id = 1;
+     }
+     slot->seq = next_request_seq++;
+     slot->code = code;
+     slot->addr = *addr;
+     slot->port = port;
+     slot->uri_path = uri_path;
+     if (payload_len > 0) {
+          memcpy(slot->payload, payload, payload_len);
+     }
+     slot->payload_len = payload_len;
+     slot->records = 1;
+     slot->done_cb[0] = done_cb;
+
+     k_spin_unlock(&request_slots_lock, key);
+
+     k_work_submit(&request_send_work);
+     return 0;
+}
+
+int request_manager_send(otCoapCode code, const otIp6Address *addr, const char *uri_path,
+                   const uint8_t *payload, uint16_t payload_len, request_done_cb_t done_cb)
+{
+     return request_manager_send_to(code, addr, COAP_PORT, uri_path, payload, payload_len, done_cb);
+}
+
+uint32_t request_manager_timeouts_get(void)
+{
+     return (uint32_t)atomic_get(&requests_timed_out);
+}
+
+void request_manager_timeout_cb_set(request_timeout_cb_t callback)
+{
+     on_request_timeout = callback;
+}
+
+void request_manager_init(void)
+{
+     k_work_init(&request_send_work, request_send_handler);
+     k_work_init_delayable(&request_timeout_work, request_timeout_handler);
+}
+
+static int rtt_cmd_handler(const struct shell *sh, size_t argc, char **argv)
+{
+     char addr_string[OT_IP6_ADDRESS_STRING_SIZE];
+     struct rtt_entry entries[ARRAY_SIZE(rtt_entries)];
+
+     ARG_UNUSED(argc);
+     ARG_UNUSED(argv);
+
+     k_spinlock_key_t key = k_spin_lock(&rtt_lock);
+     memcpy(entries, rtt_entries, sizeof(entries));
+     k_spin_unlock(&rtt_lock, key);
+
+     for (int i = 0; i < ARRAY_SIZE(entries); i++) {
+          if (!entries[i].in_use) {
+               continue;
+          }
+
+          otIp6AddressToString(&entries[i].addr, addr_string, sizeof(addr_string));
+          shell_print(sh, "%s rto: %d ms", addr_string, entries[i].rto);
+          shell_print(sh, "  strong: srtt %d ms rttvar %d ms rto %d ms (%u samples)",
+                    entries[i].strong.srtt, entries[i].strong.rttvar, entries[i].strong.rto,
+                    entries[i].strong.samples);
+          shell_print(sh, "  weak: srtt %d ms rttvar %d ms rto %d ms (%u samples)",
+                    entries[i].weak.srtt, entries[i].weak.rttvar, entries[i].weak.rto,
+                    entries[i].weak.samples);
+     }
+     return 0;
+}
+
+SHELL_CMD_REGISTER(rtt, NULL, "Round-trip time estimates of the request destinations", rtt_cmd_handler);
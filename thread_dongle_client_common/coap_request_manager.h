@@ -0,0 +1,77 @@
+/**
+ * @file
+ * @defgroup coap_request_manager CoAP requests of the client nodes
+ * @{
+ */
+
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __COAP_REQUEST_MANAGER_H__
+#define __COAP_REQUEST_MANAGER_H__
+
+#include <openthread/coap.h>
+#include <openthread/ip6.h>
+
+/* Maximum size of a request or response payload */
+#define REQUEST_PAYLOAD_MAX_SIZE 64
+
+/** @brief Type indicates function called when a request is completed.
+ *
+ * @param[in] result 0 when a response is received, -ETIMEDOUT when no response
+ *                   arrived in time, negative error code if the request could not be sent.
+ * @param[in] payload NULL terminated response payload, NULL if none.
+ * @param[in] payload_len response payload length.
+ * @param[in] from address of the responding node, NULL if none.
+ */
+typedef void (*request_done_cb_t)(int result, const uint8_t *payload, uint16_t payload_len,
+                          const otIp6Address *from);
+
+/** @brief Type indicates function called when a request completes without response in time.
+ *
+ * @param[in] addr destination of the request.
+ */
+typedef void (*request_timeout_cb_t)(const otIp6Address *addr);
+
+/** @brief Initialize the request manager, the OpenThread CoAP service must be started.
+ */
+void request_manager_init(void);
+
+/** @brief Queue a request, sent as soon as the in-flight window allows it.
+ *
+ * Unicast requests are confirmable, retransmitted after the RTO estimated from the
+ * round-trip times to their destination (shell command rtt). Multicast requests are
+ * non confirmable. A GET request already queued or in flight for the same resource
+ * and destination is coalesced with it. A command PUT is appended to a commands PUT
+ * still queued for the same destination, as cmd;cmd;... records. May be called from ISR.
+ *
+ * @retval 0 on success.
+ * @retval -EMSGSIZE if the payload is too long.
+ * @retval -ENOMEM if no request slot is free.
+ */
+int request_manager_send(otCoapCode code, const otIp6Address *addr, const char *uri_path,
+                   const uint8_t *payload, uint16_t payload_len, request_done_cb_t done_cb);
+
+/** @brief Queue a request to another port than COAP_PORT, see request_manager_send().
+ */
+int request_manager_send_to(otCoapCode code, const otIp6Address *addr, uint16_t port, const char *uri_path,
+                      const uint8_t *payload, uint16_t payload_len, request_done_cb_t done_cb);
+
+/** @brief Get the number of requests completed with a timeout since the initialization.
+ *
+ * @return Number of requests without response, wrapping around.
+ */
+uint32_t request_manager_timeouts_get(void);
+
+/** @brief Set the function called when a request times out, before its done callbacks.
+ */
+void request_manager_timeout_cb_set(request_timeout_cb_t callback);
+
+#endif
+
+/**
+ * @}
+ */
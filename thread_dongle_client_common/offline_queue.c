@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <string.h>
+
+#include "offline_queue.h"
+
+static struct offline_request offline_requests[CONFIG_OFFLINE_QUEUE_SIZE];
+static bool offline_slot_used[CONFIG_OFFLINE_QUEUE_SIZE];
+static struct k_spinlock offline_lock;
+static uint8_t offline_depth;
+static uint32_t offline_drops;
+
+/* Request sent first (from_flush) or dropped first, must be called with the queue lock held */
+static int offline_request_select(bool from_flush)
+{
+     int selected = -1;
+
+     for (int i = 0; i < ARRAY_SIZE(offline_requests); i++) {
+          if (!offline_slot_used[i]) {
+               continue;
+          }
+          if (selected < 0) {
+               selected = i;
+               continue;
+          }
+
+          const struct offline_request *request = &offline_requests[i];
+          const struct offline_request *current = &offline_requests[selected];
+          if (request->priority != current->priority) {
+               if (from_flush == (request->priority > current->priority)) {
+                    selected = i;
+               }
+          } else if (request->time < current->time) {
+               selected = i;
+          }
+     }
+     return selected;
+}
+
+/* Same keep alive or status request already queued, must be called with the queue lock held */
+static bool offline_request_queued(enum offline_priority priority, otCoapCode code, const char *uri_path,
+                           const uint8_t *payload, uint16_t payload_len)
+{
+     for (int i = 0; i < ARRAY_SIZE(offline_requests); i++) {
+          const struct offline_request *request = &offline_requests[i];
+
+          if (offline_slot_used[i] && (request->priority == priority) && (request->code == code) &&
+              (strcmp(request->uri_path, uri_path) == 0) && (request->payload_len == payload_len) &&
+              ((payload_len == 0) || (memcmp(request->payload, payload, payload_len) == 0))) {
+               return true;
+          }
+     }
+     return false;
+}
+
+int offline_queue_push(enum offline_priority priority, otCoapCode code, const char *uri_path,
+                 const uint8_t *payload, uint16_t payload_len, request_done_cb_t done_cb)
+{
+     int slot = -1;
+
+     if (payload_len > REQUEST_PAYLOAD_MAX_SIZE) {
+          return -EMSGSIZE;
+     }
+
+     k_spinlock_key_t key = k_spin_lock(&offline_lock);
+
+     if ((priority <= OFFLINE_PRIORITY_STATUS) &&
+         offline_request_queued(priority, code, uri_path, payload, payload_len)) {
+          k_spin_unlock(&offline_lock, key);
+          return 0;
+     }
+
+     for (int i = 0; i < ARRAY_SIZE(offline_requests); i++) {
+          if (!offline_slot_used[i]) {
+               slot = i;
+               break;
+          }
+     }
+
+     if (slot < 0) {
+          int victim = offline_request_select(false);
+          enum offline_priority victim_priority = offline_requests[victim].priority;
+
+          offline_drops ++;
+          if (victim_priority > priority) {
+               k_spin_unlock(&offline_lock, key);
+               printk("THREAD [ERROR]: Offline queue full, request to /%s dropped (drops: %d)\r\n",
+                      uri_path, offline_drops);
+               return -ENOBUFS;
+          }
+
+          printk("THREAD [ERROR]: Offline queue full, queued request to /%s dropped (drops: %d)\r\n",
+                 offline_requests[victim].uri_path, offline_drops);
+          offline_slot_used[victim] = false;
+          offline_depth --;
+          slot = victim;
+     }
+
+     struct offline_request *request = &offline_requests[slot];
+     request->priority = priority;
+     request->code = code;
+     request->uri_path = uri_path;
+     if (payload_len > 0) {
+          memcpy(request->payload, payload, payload_len);
+     }
+     request->payload_len = payload_len;
+     request->done_cb = done_cb;
+     request->time = k_uptime_get();
+     offline_slot_used[slot] = true;
+     offline_depth ++;
+     uint8_t depth = offline_depth;
+
+     k_spin_unlock(&offline_lock, key);
+
+     printk("THREAD [DEBBUG]: Not attached, request to /%s queued (depth: %d/%d)\r\n",
+            uri_path, depth, CONFIG_OFFLINE_QUEUE_SIZE);
+     return 0;
+}
+
+void offline_queue_flush(offline_request_send_t send)
+{
+     struct offline_request request;
+     int64_t max_age = 0;
+     int sent = 0;
+
+     while (true) {
+          k_spinlock_key_t key = k_spin_lock(&offline_lock);
+          int slot = offline_request_select(true);
+          if (slot >= 0) {
+               request = offline_requests[slot];
+               offline_slot_used[slot] = false;
+               offline_depth --;
+          }
+          k_spin_unlock(&offline_lock, key);
+
+          if (slot < 0) {
+               break;
+          }
+
+          int64_t age = k_uptime_get() - request.time;
+          max_age = MAX(max_age, age);
+          sent ++;
+          printk("THREAD [DEBBUG]: Sending queued request to /%s, age: %d ms\r\n", request.uri_path, (int)age);
+          send(&request);
+     }
+
+     if (sent > 0) {
+          printk("THREAD [DEBBUG]: Offline queue flushed, %d requests (max age: %d ms, drops: %d)\r\n",
+                 sent, (int)max_age, offline_drops);
+     }
+}
@@ -0,0 +1,65 @@
+/**
+ * @file
+ * @defgroup offline_queue Requests queued while the client is detached
+ * @{
+ */
+
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __OFFLINE_QUEUE_H__
+#define __OFFLINE_QUEUE_H__
+
+#include "coap_request_manager.h"
+
+/* Requests priorities, the lowest ones are dropped first when the queue is full */
+enum offline_priority {
+     OFFLINE_PRIORITY_KEEP_ALIVE,
+     OFFLINE_PRIORITY_STATUS,
+     OFFLINE_PRIORITY_COMMAND,
+     OFFLINE_PRIORITY_ALARM,
+};
+
+struct offline_request {
+     enum offline_priority priority;
+     otCoapCode code;
+     const char *uri_path;
+     uint8_t payload[REQUEST_PAYLOAD_MAX_SIZE];
+     uint16_t payload_len;
+     request_done_cb_t done_cb;
+     int64_t time;
+};
+
+/** @brief Type indicates function called to send a queued request.
+ *
+ * @param[in] request request to send, valid during the call only.
+ */
+typedef void (*offline_request_send_t)(const struct offline_request *request);
+
+/** @brief Queue a request until the client is attached again.
+ *
+ * Keep alive and status requests already queued are not queued twice. When the
+ * queue is full, the oldest request of the lowest priority is dropped, unless it
+ * has a higher priority than the new one. May be called from ISR.
+ *
+ * @retval 0 on success.
+ * @retval -EMSGSIZE if the payload is too long.
+ * @retval -ENOBUFS if the request is dropped.
+ */
+int offline_queue_push(enum offline_priority priority, otCoapCode code, const char *uri_path,
+                 const uint8_t *payload, uint16_t payload_len, request_done_cb_t done_cb);
+
+/** @brief Send all the queued requests, highest priority and oldest first.
+ *
+ * @param[in] send function sending each request.
+ */
+void offline_queue_flush(offline_request_send_t send);
+
+#endif
+
+/**
+ * @}
+ */
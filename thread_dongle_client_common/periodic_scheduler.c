@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+
+#include "periodic_scheduler.h"
+
+static uint32_t random_state = 1;
+static struct k_spinlock random_lock;
+
+/* xorshift32, reproducible per node from the seed */
+static uint32_t random_next(void)
+{
+     k_spinlock_key_t key = k_spin_lock(&random_lock);
+     uint32_t x = random_state;
+     x ^= x << 13;
+     x ^= x >> 17;
+     x ^= x << 5;
+     random_state = x;
+     k_spin_unlock(&random_lock, key);
+     return x;
+}
+
+/* Period shortened or lengthened by up to the jitter, uniformly */
+static uint32_t jittered_period_get(uint32_t period_ms)
+{
+     uint32_t jitter_ms = period_ms * CONFIG_PERIODIC_JITTER_PERCENT / 100;
+
+     if (jitter_ms == 0) {
+          return period_ms;
+     }
+     return period_ms - jitter_ms + random_next() % (2 * jitter_ms + 1);
+}
+
+static void periodic_task_handler(struct k_work *item)
+{
+     struct k_work_delayable *work = k_work_delayable_from_work(item);
+     struct periodic_task *task = CONTAINER_OF(work, struct periodic_task, work);
+
+     k_work_schedule(&task->work, K_MSEC(jittered_period_get(task->period_ms)));
+     task->handler();
+}
+
+void periodic_scheduler_init(uint32_t seed)
+{
+     // xorshift state must not be 0
+     random_state = (seed != 0) ? seed : 1;
+}
+
+void periodic_task_start(struct periodic_task *task, uint32_t period_ms, periodic_task_handler_t handler)
+{
+     uint32_t offset_ms = random_next() % period_ms;
+
+     task->handler = handler;
+     task->period_ms = period_ms;
+     task->min_period_ms = period_ms;
+     task->max_period_ms = period_ms;
+     k_work_init_delayable(&task->work, periodic_task_handler);
+     k_work_schedule(&task->work, K_MSEC(offset_ms));
+
+     printk("SCHEDULER [DEBBUG]: Periodic task every %d ms, first run in %d ms\r\n", period_ms, offset_ms);
+}
+
+void periodic_task_adaptive_start(struct periodic_task *task, uint32_t min_period_ms, uint32_t max_period_ms,
+                          periodic_task_handler_t handler)
+{
+     periodic_task_start(task, min_period_ms, handler);
+     task->max_period_ms = MAX(max_period_ms, min_period_ms);
+}
+
+void periodic_task_changed(struct periodic_task *task, bool changed)
+{
+     uint32_t period_ms = changed ? task->min_period_ms : MIN(task->period_ms * 2, task->max_period_ms);
+
+     if (period_ms == task->period_ms) {
+          return;
+     }
+
+     // Do not wait for the end of a long stable period once something changed
+     if (period_ms < task->period_ms) {
+          uint32_t remaining_ms = k_ticks_to_ms_floor32(k_work_delayable_remaining_get(&task->work));
+          if (remaining_ms > period_ms) {
+               k_work_reschedule(&task->work, K_MSEC(jittered_period_get(period_ms)));
+          }
+     }
+     task->period_ms = period_ms;
+
+     printk("SCHEDULER [DEBBUG]: Periodic task every %d ms\r\n", period_ms);
+}
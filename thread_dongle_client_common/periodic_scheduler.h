@@ -0,0 +1,75 @@
+/**
+ * @file
+ * @defgroup periodic_scheduler Desynchronised periodic tasks of the client nodes
+ * @{
+ */
+
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __PERIODIC_SCHEDULER_H__
+#define __PERIODIC_SCHEDULER_H__
+
+#include <zephyr/kernel.h>
+
+/** @brief Type indicates function called at each period of a task, from the system workqueue.
+ */
+typedef void (*periodic_task_handler_t)(void);
+
+struct periodic_task {
+     struct k_work_delayable work;
+     periodic_task_handler_t handler;
+     uint32_t period_ms;
+     uint32_t min_period_ms;
+     uint32_t max_period_ms;
+};
+
+/** @brief Seed the offsets and jitters of the tasks.
+ *
+ * @param[in] seed value specific to the node, e.g. a hash of its EUI-64.
+ */
+void periodic_scheduler_init(uint32_t seed);
+
+/** @brief Start a periodic task.
+ *
+ * The first run happens after a random offset within the period, then each period
+ * is randomly shortened or lengthened by up to CONFIG_PERIODIC_JITTER_PERCENT, so
+ * that the nodes booted together do not stay phase locked. The mean period is kept.
+ *
+ * @param[in] task task to start.
+ * @param[in] period_ms mean period of the task.
+ * @param[in] handler function called at each period.
+ */
+void periodic_task_start(struct periodic_task *task, uint32_t period_ms, periodic_task_handler_t handler);
+
+/** @brief Start a periodic task whose period adapts to the changes it observes.
+ *
+ * The task starts at its shortest period, see periodic_task_changed().
+ *
+ * @param[in] task task to start.
+ * @param[in] min_period_ms period right after a change.
+ * @param[in] max_period_ms longest period during stable periods.
+ * @param[in] handler function called at each period.
+ */
+void periodic_task_adaptive_start(struct periodic_task *task, uint32_t min_period_ms, uint32_t max_period_ms,
+                          periodic_task_handler_t handler);
+
+/** @brief Report the outcome of a run of an adaptive task.
+ *
+ * A change brings the period back to its minimum, and the next run is brought
+ * forward if it was further away. Each run without change doubles the period,
+ * up to its maximum. Must be called from the system workqueue.
+ *
+ * @param[in] task adaptive task.
+ * @param[in] changed true if the run observed a change.
+ */
+void periodic_task_changed(struct periodic_task *task, bool changed);
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <thread_dongle_interface.h>
+#include <openthread/thread.h>
+#include <openthread/netdata.h>
+#include <openthread/link.h>
+#include <openthread/ip6.h>
+#include <string.h>
+
+#include "server_discovery.h"
+
+// Requests to the server timed out in a row before falling back to multicast discovery
+#define SERVER_UNANSWERED_REQUESTS_MAX 3
+
+static bool is_attached;
+static int64_t attach_time;
+
+/* Servers multicast group address, only the server nodes process the requests */
+static otIp6Address server_multicast_addr = {
+     .mFields.m8 = GROUP_MULTICAST_ADDR(GROUP_ID_SERVERS)
+};
+
+/* Server unicast address and port, from its service entry in Thread Network Data, or from its
+ * replies while no entry is resolved. Used while server_addr_cached, the entry is kept when going
+ * back to multicast discovery.
+ */
+static otIp6Address server_unicast_addr;
+static uint16_t server_port = COAP_PORT;
+static bool server_service_resolved;
+static bool server_addr_cached;
+static atomic_t unanswered_requests = ATOMIC_INIT(0);
+static atomic_t server_requests = ATOMIC_INIT(0);
+static struct k_spinlock server_addr_lock;
+
+/* Caching proxy of the parent router, answering the status requests */
+static otIp6Address proxy_addr;
+static bool proxy_addr_cached;
+
+/* Requests timed out at the last server reply, to measure the requests lost during a server failover */
+static uint32_t timeouts_at_reply;
+static int64_t last_reply_time;
+
+/* Servers shards: each server owns the clients whose EUI-64 hash modulo the shard count is its index */
+static uint32_t device_hash;
+static uint8_t server_shard_count = 1;
+
+/* Status notifications group of the shard joined, once the client processes the downlink requests */
+static bool status_group_subscribed;
+
+/* Forget the server address and go back to multicast discovery */
+static void server_addr_invalidate(void)
+{
+     k_spinlock_key_t key = k_spin_lock(&server_addr_lock);
+     server_addr_cached = false;
+     k_spin_unlock(&server_addr_lock, key);
+     atomic_clear(&unanswered_requests);
+}
+
+/* Check if a reply comes from the caching proxy of the parent */
+static bool reply_from_proxy(const otIp6Address *from)
+{
+     bool from_proxy;
+
+     if (from == NULL) {
+          return false;
+     }
+
+     k_spinlock_key_t key = k_spin_lock(&server_addr_lock);
+     from_proxy = proxy_addr_cached && (memcmp(&proxy_addr, from, sizeof(otIp6Address)) == 0);
+     k_spin_unlock(&server_addr_lock, key);
+     return from_proxy;
+}
+
+/* FNV-1a hash of the factory EUI-64, identifies this client among the shards */
+static uint32_t device_hash_compute(otInstance *ot)
+{
+     otExtAddress eui64;
+     uint32_t hash = 2166136261U;
+
+     otLinkGetFactoryAssignedIeeeEui64(ot, &eui64);
+     for (int i = 0; i < sizeof(eui64.m8); i++) {
+          hash ^= eui64.m8[i];
+          hash *= 16777619U;
+     }
+     return hash;
+}
+
+/* Server shard of this client, from the shard count advertised by the servers */
+static uint8_t server_shard_get(void)
+{
+     k_spinlock_key_t key = k_spin_lock(&server_addr_lock);
+     uint8_t shard = device_hash % server_shard_count;
+     k_spin_unlock(&server_addr_lock, key);
+     return shard;
+}
+
+/* Join a multicast group addressed by the downlink requests or the status notifications */
+static void group_subscribe(otInstance *ot, uint16_t group_id)
+{
+     const uint8_t group_addr[] = GROUP_MULTICAST_ADDR(group_id);
+     otIp6Address addr;
+
+     memcpy(addr.mFields.m8, group_addr, sizeof(group_addr));
+     otError error = otIp6SubscribeMulticastAddress(ot, &addr);
+     if ((error != OT_ERROR_NONE) && (error != OT_ERROR_ALREADY)) {
+          printk("THREAD [ERROR]: Cannot join multicast group %x, error: %d\r\n", group_id, error);
+     }
+}
+
+/* Move the status notifications subscription to the group of the server shard of this client */
+static void status_group_shard_set(otInstance *ot, uint8_t previous_shard, uint8_t shard)
+{
+     const uint8_t previous_group_addr[] = GROUP_MULTICAST_ADDR(GROUP_ID_STATUS_SUBSCRIBERS + previous_shard);
+     otIp6Address addr;
+
+     if (!status_group_subscribed || (shard == previous_shard)) {
+          return;
+     }
+
+     memcpy(addr.mFields.m8, previous_group_addr, sizeof(previous_group_addr));
+     otIp6UnsubscribeMulticastAddress(ot, &addr);
+     group_subscribe(ot, GROUP_ID_STATUS_SUBSCRIBERS + shard);
+}
+
+/* A request timed out: count it against the server when it was sent to its unicast address */
+static void on_request_timeout(const otIp6Address *addr)
+{
+     k_spinlock_key_t key = k_spin_lock(&server_addr_lock);
+     bool to_server = server_addr_cached && (memcmp(&server_unicast_addr, addr, sizeof(otIp6Address)) == 0);
+     k_spin_unlock(&server_addr_lock, key);
+
+     if (to_server && (atomic_inc(&unanswered_requests) + 1 >= SERVER_UNANSWERED_REQUESTS_MAX)) {
+          printk("THREAD [ERROR]: Server not answering, back to multicast discovery\r\n");
+          server_addr_invalidate();
+     }
+}
+
+/* Shard of this client, the servers multicast group of the shard is the fallback address */
+static void server_shard_count_set(otInstance *ot, uint8_t shard_count)
+{
+     uint16_t group_id;
+
+     if ((shard_count == 0) || (shard_count == server_shard_count)) {
+          return;
+     }
+
+     k_spinlock_key_t key = k_spin_lock(&server_addr_lock);
+     uint8_t previous_shard = device_hash % server_shard_count;
+     server_shard_count = shard_count;
+     group_id = GROUP_ID_SERVERS + (device_hash % server_shard_count);
+     server_multicast_addr.mFields.m8[14] = group_id >> 8;
+     server_multicast_addr.mFields.m8[15] = group_id & 0xff;
+     k_spin_unlock(&server_addr_lock, key);
+
+     printk("THREAD [DEBBUG]: %d server shards, using shard %d\r\n", shard_count, device_hash % shard_count);
+     status_group_shard_set(ot, previous_shard, device_hash % shard_count);
+}
+
+/* RLOC of a node: mesh-local prefix + 0000:00ff:fe00:<rloc16> */
+static void rloc_addr_build(otInstance *ot, uint16_t rloc16, otIp6Address *addr)
+{
+     memset(addr, 0, sizeof(*addr));
+     memcpy(addr->mFields.m8, otThreadGetMeshLocalPrefix(ot)->m8, 8);
+     addr->mFields.m8[11] = 0xff;
+     addr->mFields.m8[12] = 0xfe;
+     addr->mFields.m8[14] = rloc16 >> 8;
+     addr->mFields.m8[15] = rloc16 & 0xff;
+}
+
+static bool service_name_match(const otServiceConfig *config, const char *name)
+{
+     return (config->mEnterpriseNumber == SERVICE_ENTERPRISE_NUMBER) &&
+            (config->mServiceDataLength == strlen(name)) &&
+            (memcmp(config->mServiceData, name, config->mServiceDataLength) == 0);
+}
+
+void server_discovery_init(otInstance *ot)
+{
+     device_hash = device_hash_compute(ot);
+     request_manager_timeout_cb_set(on_request_timeout);
+}
+
+uint32_t server_discovery_device_hash(void)
+{
+     return device_hash;
+}
+
+void server_discovery_groups_subscribe(otInstance *ot, uint16_t class_group_id, uint16_t room_group_id)
+{
+     group_subscribe(ot, GROUP_ID_ALL_CLIENTS);
+     group_subscribe(ot, class_group_id);
+     if (room_group_id != 0) {
+          group_subscribe(ot, room_group_id);
+     }
+     group_subscribe(ot, GROUP_ID_STATUS_SUBSCRIBERS + server_shard_get());
+     status_group_subscribed = true;
+}
+
+bool server_discovery_attached(void)
+{
+     bool attached = !is_attached;
+
+     if (attached) {
+          attach_time = k_uptime_get();
+     }
+     is_attached = true;
+     return attached;
+}
+
+void server_discovery_detached(void)
+{
+     server_addr_invalidate();
+
+     k_spinlock_key_t key = k_spin_lock(&server_addr_lock);
+     proxy_addr_cached = false;
+     k_spin_unlock(&server_addr_lock, key);
+     is_attached = false;
+}
+
+bool server_discovery_is_attached(void)
+{
+     return is_attached;
+}
+
+void server_discovery_resolve(otInstance *ot)
+{
+     otNetworkDataIterator iterator = OT_NETWORK_DATA_ITERATOR_INIT;
+     otServiceConfig config;
+     otRouterInfo parent;
+     bool found = false;
+     bool proxy_found = false;
+     uint16_t server_rloc16 = 0;
+     uint16_t port = COAP_PORT;
+     uint8_t server_epoch = 0;
+
+     bool is_child = (otThreadGetDeviceRole(ot) == OT_DEVICE_ROLE_CHILD) &&
+                     (otThreadGetParentInfo(ot, &parent) == OT_ERROR_NONE);
+
+     while (otNetDataGetNextService(ot, &iterator, &config) == OT_ERROR_NONE) {
+          uint8_t epoch = 0;
+
+          if (service_name_match(&config, PROXY_SERVICE_NAME)) {
+               proxy_found |= is_child && (config.mServerConfig.mRloc16 == parent.mRloc16);
+               continue;
+          }
+
+          if (!service_name_match(&config, SERVICE_NAME)) {
+               continue;
+          }
+
+          // Only use the server owning the shard of this client, an entry without shard data may be of any shard
+          if (config.mServerConfig.mServerDataLength < SERVICE_SERVER_DATA_SIZE) {
+               continue;
+          }
+          uint8_t shard_index = config.mServerConfig.mServerData[2];
+          server_shard_count_set(ot, config.mServerConfig.mServerData[3]);
+          if (shard_index != device_hash % server_shard_count) {
+               continue;
+          }
+          epoch = config.mServerConfig.mServerData[4];
+
+          // A standby server that took over has a newer epoch than the server it replaced
+          if (!found || SERVER_EPOCH_NEWER(epoch, server_epoch) ||
+              ((epoch == server_epoch) && (config.mServerConfig.mRloc16 < server_rloc16))) {
+               found = true;
+               server_rloc16 = config.mServerConfig.mRloc16;
+               server_epoch = epoch;
+               // The server data starts with the CoAP port of the server
+               if (config.mServerConfig.mServerDataLength >= sizeof(uint16_t)) {
+                    port = sys_get_be16(config.mServerConfig.mServerData);
+               }
+          }
+     }
+
+     k_spinlock_key_t key = k_spin_lock(&server_addr_lock);
+     bool proxy_changed = proxy_found != proxy_addr_cached;
+     if (proxy_found) {
+          rloc_addr_build(ot, parent.mRloc16, &proxy_addr);
+     }
+     proxy_addr_cached = proxy_found;
+     k_spin_unlock(&server_addr_lock, key);
+
+     if (proxy_changed) {
+          printk("THREAD [DEBBUG]: Parent caching proxy %s\r\n", proxy_found ? "found" : "lost");
+     }
+
+     // Without a service entry, the replies of the server provide its address
+     if (!found) {
+          key = k_spin_lock(&server_addr_lock);
+          bool withdrawn = server_service_resolved;
+          server_service_resolved = false;
+          k_spin_unlock(&server_addr_lock, key);
+
+          if (withdrawn) {
+               printk("THREAD [DEBBUG]: %s service entry withdrawn\r\n", SERVICE_NAME);
+          }
+          return;
+     }
+
+     otIp6Address addr;
+     rloc_addr_build(ot, server_rloc16, &addr);
+
+     key = k_spin_lock(&server_addr_lock);
+     bool resolved = !server_service_resolved;
+     bool changed = server_service_resolved &&
+                    ((memcmp(&server_unicast_addr, &addr, sizeof(otIp6Address)) != 0) || (server_port != port));
+     server_unicast_addr = addr;
+     server_port = port;
+     server_service_resolved = true;
+     server_addr_cached = true;
+     k_spin_unlock(&server_addr_lock, key);
+
+     if (resolved) {
+          printk("THREAD [DEBBUG]: %s service resolved (server %04x) in %d ms after attach\r\n",
+                 SERVICE_NAME, server_rloc16, (int)(k_uptime_get() - attach_time));
+     } else if (changed) {
+          printk("THREAD [DEBBUG]: %s service moved to server %04x (epoch %d)\r\n",
+                 SERVICE_NAME, server_rloc16, server_epoch);
+     }
+}
+
+void server_destination_get(otIp6Address *addr, uint16_t *port)
+{
+     k_spinlock_key_t key = k_spin_lock(&server_addr_lock);
+     *addr = server_addr_cached ? server_unicast_addr : server_multicast_addr;
+     *port = server_addr_cached ? server_port : COAP_PORT;
+     k_spin_unlock(&server_addr_lock, key);
+}
+
+int server_request_send(otCoapCode code, const char *uri_path, const uint8_t *payload, uint16_t payload_len,
+                        request_done_cb_t done_cb)
+{
+     otIp6Address addr;
+     uint16_t port;
+
+     atomic_inc(&server_requests);
+     server_destination_get(&addr, &port);
+
+     int ret = request_manager_send_to(code, &addr, port, uri_path, payload, payload_len, done_cb);
+     if (ret) {
+          printk("THREAD [ERROR]: Cannot send request to /%s, error: %d\r\n", uri_path, ret);
+     }
+     return ret;
+}
+
+int server_status_request_send(const char *uri_path, request_done_cb_t done_cb)
+{
+     otIp6Address addr;
+
+     k_spinlock_key_t key = k_spin_lock(&server_addr_lock);
+     bool use_proxy = proxy_addr_cached;
+     addr = proxy_addr;
+     k_spin_unlock(&server_addr_lock, key);
+
+     if (!use_proxy) {
+          return server_request_send(OT_COAP_CODE_GET, uri_path, NULL, 0u, done_cb);
+     }
+
+     return request_manager_send(OT_COAP_CODE_GET, &addr, uri_path, NULL, 0u, done_cb);
+}
+
+void server_reply_received(const otIp6Address *from)
+{
+     if (reply_from_proxy(from)) {
+          return;
+     }
+
+     atomic_clear(&unanswered_requests);
+
+     int64_t now = k_uptime_get();
+     uint32_t timeouts = request_manager_timeouts_get();
+     uint32_t requests_lost = timeouts - timeouts_at_reply;
+     timeouts_at_reply = timeouts;
+     if (requests_lost > 0) {
+          char report[32];
+          int report_len = snprintk(report, sizeof(report), "%s%u_%d", LOST_REQUESTS_REPORT_PREFIX,
+                                    requests_lost, (int)(now - last_reply_time));
+          printk("THREAD [DEBBUG]: Server answering again, %u requests lost in %d ms\r\n",
+                 requests_lost, (int)(now - last_reply_time));
+          // Report it to the gateway through the server
+          server_request_send(OT_COAP_CODE_PUT, COMMANDS_URI_PATH, (const uint8_t *)report,
+                              MIN(report_len, sizeof(report) - 1), NULL);
+     }
+     last_reply_time = now;
+
+     // A server answers again: back to the resolved service entry. The reply address (e.g. the
+     // ML-EID of the server answering a multicast request) is only cached while no service entry
+     // is resolved, an entry resolved later replaces it.
+     k_spinlock_key_t key = k_spin_lock(&server_addr_lock);
+     bool reply_addr_used = !server_addr_cached && !server_service_resolved && (from != NULL);
+     bool back_to_unicast = !server_addr_cached && (server_service_resolved || reply_addr_used);
+     if (reply_addr_used) {
+          server_unicast_addr = *from;
+          server_port = COAP_PORT;
+     }
+     if (back_to_unicast) {
+          server_addr_cached = true;
+     }
+     k_spin_unlock(&server_addr_lock, key);
+
+     if (reply_addr_used) {
+          printk("THREAD [DEBBUG]: Server answering, no %s service entry: unicast to its reply address\r\n",
+                 SERVICE_NAME);
+     } else if (back_to_unicast) {
+          printk("THREAD [DEBBUG]: Server answering, back to unicast\r\n");
+     }
+}
+
+void server_offline_request_send(const struct offline_request *request)
+{
+     // The status requests may be answered by the caching proxy
+     if ((request->code == OT_COAP_CODE_GET) && ((strcmp(request->uri_path, RESSOURCES_URI_PATH) == 0) ||
+                                                 (strcmp(request->uri_path, POWER_STRIP_URI_PATH) == 0))) {
+          server_status_request_send(request->uri_path, request->done_cb);
+          return;
+     }
+
+     server_request_send(request->code, request->uri_path, request->payload, request->payload_len,
+                         request->done_cb);
+}
+
+void server_work_submit_or_queue(struct k_work *work, enum offline_priority priority, otCoapCode code,
+                                 const char *uri_path, const uint8_t *payload, uint16_t payload_len,
+                                 request_done_cb_t done_cb)
+{
+     if (is_attached) {
+          k_work_submit(work);
+          return;
+     }
+
+     offline_queue_push(priority, code, uri_path, payload, payload_len, done_cb);
+}
+
+atomic_val_t server_requests_count(void)
+{
+     return atomic_get(&server_requests);
+}
@@ -0,0 +1,112 @@
+/**
+ * @file
+ * @defgroup server_discovery Discovery and failover of the server of the client nodes
+ * @{
+ */
+
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __SERVER_DISCOVERY_H__
+#define __SERVER_DISCOVERY_H__
+
+#include <zephyr/kernel.h>
+#include <openthread/instance.h>
+
+#include "coap_request_manager.h"
+#include "offline_queue.h"
+
+/** @brief Initialize the server discovery, with the OpenThread API lock held.
+ *
+ * Hashes the factory EUI-64 of this node, the hash selects its server shard.
+ */
+void server_discovery_init(otInstance *ot);
+
+/** @brief Get the hash of the factory EUI-64 of this node.
+ */
+uint32_t server_discovery_device_hash(void);
+
+/** @brief Join the multicast groups addressed by the downlink requests, and the status
+ *         notifications group of the server shard of this client.
+ *
+ * The status notifications group follows the shard when the servers shard count changes.
+ * Called on each role change, with the OpenThread API lock held.
+ *
+ * @param[in] class_group_id group of the device class of this client.
+ * @param[in] room_group_id group of the room of this client, 0 if none.
+ */
+void server_discovery_groups_subscribe(otInstance *ot, uint16_t class_group_id, uint16_t room_group_id);
+
+/** @brief Report that the client attached to a Thread network, called on each role change.
+ *
+ * @return true if the client was detached so far, the requests queued meanwhile can be sent.
+ */
+bool server_discovery_attached(void);
+
+/** @brief Report that the client detached, the server and proxy addresses are forgotten.
+ */
+void server_discovery_detached(void);
+
+/** @brief Check if the client is attached, the requests are queued otherwise.
+ */
+bool server_discovery_is_attached(void);
+
+/** @brief Resolve the server of the shard of this client, and the caching proxy of
+ *         the parent router, from the services advertised in Thread Network Data.
+ *
+ * Called once attached and whenever the network data or the parent changes,
+ * with the OpenThread API lock held.
+ */
+void server_discovery_resolve(otInstance *ot);
+
+/** @brief Get the current destination of the server requests: the resolved server (its reply
+ *         address without service entry), or the servers multicast group of the shard of this client.
+ */
+void server_destination_get(otIp6Address *addr, uint16_t *port);
+
+/** @brief Send a request to the server, by unicast once its address is known.
+ *
+ * Falls back to the servers multicast group once several requests in a row to the
+ * server timed out, until a server answers again.
+ * See request_manager_send() for the return values.
+ */
+int server_request_send(otCoapCode code, const char *uri_path, const uint8_t *payload, uint16_t payload_len,
+                        request_done_cb_t done_cb);
+
+/** @brief Send a status GET to the caching proxy of the parent router if any, to the server otherwise.
+ */
+int server_status_request_send(const char *uri_path, request_done_cb_t done_cb);
+
+/** @brief Report a reply to a server request, called from its done callback.
+ *
+ * A reply of the server brings the client back to unicast, and reports to the
+ * gateway the requests lost since the previous reply, e.g. during a failover.
+ *
+ * @param[in] from address of the responding node, replies of the caching proxy are ignored.
+ */
+void server_reply_received(const otIp6Address *from);
+
+/** @brief Send a request queued while detached, offline_queue_flush() callback.
+ */
+void server_offline_request_send(const struct offline_request *request);
+
+/** @brief Submit the work sending a request, or queue the request until the client is attached again.
+ */
+void server_work_submit_or_queue(struct k_work *work, enum offline_priority priority, otCoapCode code,
+                                 const char *uri_path, const uint8_t *payload, uint16_t payload_len,
+                                 request_done_cb_t done_cb);
+
+/** @brief Get the number of requests sent to the server, the caching proxy excluded.
+ *
+ * @return Number of requests, wrapping around.
+ */
+atomic_val_t server_requests_count(void);
+
+#endif
+
+/**
+ * @}
+ */
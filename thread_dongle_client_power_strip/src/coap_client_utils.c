@@ -7,35 +7,76 @@
 #include <zephyr/kernel.h>
 #include <thread_dongle_interface.h>
 #include <dk_buttons_and_leds.h>
-#include <net/coap_utils.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/net/openthread.h>
-#include <zephyr/net/socket.h>
 #include <openthread/thread.h>
+#include <openthread/coap.h>
+#include <openthread/ip6.h>
+#include <openthread/server.h>
+#include <zephyr/sys/byteorder.h>
+#include <stdlib.h>
 
 #include "coap_client_utils.h"
+#include "coap_request_manager.h"
+#include "offline_queue.h"
+#include "server_discovery.h"
 
-static bool is_connected;
+// Device class multicast group
+#define CLIENT_CLASS_GROUP_ID GROUP_ID_POWER_STRIPS
+
+// Delay before sending again a relays update not acknowledged by the server
+#define RELAYS_UPDATE_RETRY_MS 2000
+
+static downlink_request_cb_t on_downlink_request;
 
 static struct k_work send_keep_alive_work;
 static struct k_work power_strip_status_work;
 static struct k_work on_connect_work;
 static struct k_work on_disconnect_work;
 
+/* Completion of the periodic status request, reported to the application from the system workqueue */
+static status_reply_cb_t on_status_reply;
+static struct k_work_delayable status_reply_work;
+static atomic_t status_reply_result = ATOMIC_INIT(0);
+static atomic_t status_reply_changed = ATOMIC_INIT(0);
+
+
+/**@brief Definition of CoAP resources for status change notifications. */
+static otCoapResource notify_resource = {
+     .mUriPath = NOTIFY_URI_PATH,
+     .mHandler = NULL,
+     .mContext = NULL,
+     .mNext = NULL,
+};
 
-/* Options supported by the server */
-static const char *const commands_option[] = { COMMANDS_URI_PATH, NULL };
-static const char *const power_strip_status_option[] = { POWER_STRIP_URI_PATH, NULL };
+/* State version of the last status notification */
+static uint32_t status_version;
 
-/* Thread multicast mesh local address */
-static struct sockaddr_in6 multicast_local_addr = {
-     .sin6_family = AF_INET6,
-     .sin6_port = htons(COAP_PORT),
-     .sin6_addr.s6_addr = { 0xff, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 },
-     .sin6_scope_id = 0U
+/**@brief Definition of CoAP resources for downlink requests. */
+static otCoapResource downlink_resource = {
+     .mUriPath = DOWNLINK_URI_PATH,
+     .mHandler = NULL,
+     .mContext = NULL,
+     .mNext = NULL,
 };
 
+/* Relays changed locally and not acknowledged by the server yet, bit n for relay n+1.
+ * A single update is in flight at a time, it carries all the pending relays.
+ */
+static uint8_t relays_pending_mask;
+static uint8_t relays_pending_values;
+static uint8_t relays_sent_mask;
+static uint8_t relays_sent_values;
+static bool relays_update_in_flight;
+static struct k_spinlock relays_update_lock;
+static struct k_work_delayable relays_update_work;
+
+/* Requests sent to the server, a keep alive msg is only needed after a silent period */
+static atomic_val_t server_requests_at_keep_alive;
+static uint8_t keep_alives_skipped = CONFIG_CLIENT_KEEP_ALIVE_SKIP_MAX;
+static uint32_t keep_alives_sent;
+static uint32_t keep_alives_suppressed;
+
 // Variable for storing orchestrator server ressources */
 struct server_ressources {
      bool r1_status;
@@ -51,45 +92,63 @@ static struct server_ressources srv_ressources = {
     .r4_status = NULL,
 };
 
-static int on_commands_msg_reply(const struct coap_packet *response,
-                     struct coap_reply *reply,
-                     const struct sockaddr *from)
+static void on_commands_msg_reply(int result, const uint8_t *payload, uint16_t payload_size,
+                                  const otIp6Address *from)
 {
-     ARG_UNUSED(reply);
-     ARG_UNUSED(from);   
-
-     const uint8_t *payload;
-     uint16_t payload_size = 0u; 
-     char *cmd_ok = "CMD:OK";
+     char *cmd_ok = COMMANDS_OK;
 
      dk_set_led_off(RESSOURCES_STATUS_MSG_LED);
 
-     payload = coap_packet_get_payload(response, &payload_size);
+     if (result != 0) {
+          return;
+     }
+     server_reply_received(from);
+
+     if (payload == NULL) {
+          return;
+     }
 
      // Check if CMD:OK in payload
      if (strstr(payload, cmd_ok) != NULL) {
           printk("THREAD [DEBBUG]: commands msg reply: CMD_ACK\r\n"); 
           dk_set_led_off(COMMANDS_MSG_LED);     
+
+          // Gateway latency sent by the server once the gateway acknowledged the command
+          char* latency_in_payload = strstr(payload, COMMANDS_LATENCY);
+          if (latency_in_payload != NULL) {
+               printk("THREAD [DEBBUG]: command acknowledged by gateway, latency: %d ms\r\n",
+                      atoi(latency_in_payload + strlen(COMMANDS_LATENCY)));
+          }
      }
-exit:
-     return 0;
-}
 
-static int on_power_strip_status_reply(const struct coap_packet *response,
-                     struct coap_reply *reply,
-                     const struct sockaddr *from)
-{
-     const uint8_t *payload;
-     uint16_t payload_size = 0u;
+     // Check if CMD:TIMEOUT in payload
+     if (strstr(payload, COMMANDS_TIMEOUT) != NULL) {
+          printk("THREAD [ERROR]: command not acknowledged by gateway\r\n");
+     }
 
-     ARG_UNUSED(reply);
-     ARG_UNUSED(from);
+     // Check if CMD:ERROR in payload
+     if (strstr(payload, COMMANDS_ERROR) != NULL) {
+          printk("THREAD [ERROR]: command not forwarded to the gateway\r\n");
+     }
+}
 
+static void on_power_strip_status_reply(int result, const uint8_t *payload, uint16_t payload_size,
+                                        const otIp6Address *from)
+{
      printk("THREAD [DEBBUG]: Power strip status reply received from server \r\n");     
 
      dk_set_led_off(RESSOURCES_STATUS_MSG_LED);
 
-     payload = coap_packet_get_payload(response, &payload_size); 
+     if (result != 0) {
+          return;
+     }
+     server_reply_received(from);
+
+     if (payload == NULL) {
+          return;
+     }
+
+     struct server_ressources previous_ressources = srv_ressources;
 
      // Print payload
      printk("THREAD [DEBBUG]: Received payload: size: %d  payload ", payload_size);
@@ -117,8 +176,96 @@ static int on_power_strip_status_reply(const struct coap_packet *response,
           srv_ressources.r3_status=r3_received_status;
           srv_ressources.r4_status=r4_received_status;          
      }
-exit:
-     return 0;
+
+     // The relays changed locally keep their status until the server acknowledged it
+     k_spinlock_key_t key = k_spin_lock(&relays_update_lock);
+     uint8_t pending_mask = relays_pending_mask;
+     uint8_t pending_values = relays_pending_values;
+     k_spin_unlock(&relays_update_lock, key);
+
+     if (pending_mask & BIT(0)) {
+          srv_ressources.r1_status = (pending_values & BIT(0)) != 0;
+     }
+     if (pending_mask & BIT(1)) {
+          srv_ressources.r2_status = (pending_values & BIT(1)) != 0;
+     }
+     if (pending_mask & BIT(2)) {
+          srv_ressources.r3_status = (pending_values & BIT(2)) != 0;
+     }
+     if (pending_mask & BIT(3)) {
+          srv_ressources.r4_status = (pending_values & BIT(3)) != 0;
+     }
+
+     // Status updated: run the application action now
+     atomic_set(&status_reply_changed, memcmp(&previous_ressources, &srv_ressources, sizeof(srv_ressources)) != 0);
+     atomic_set(&status_reply_result, 0);
+     k_work_reschedule(&status_reply_work, K_NO_WAIT);
+}
+
+static void on_relays_update_reply(int result, const uint8_t *payload, uint16_t payload_size,
+                                   const otIp6Address *from)
+{
+     ARG_UNUSED(payload);
+     ARG_UNUSED(payload_size);
+
+     k_spinlock_key_t key = k_spin_lock(&relays_update_lock);
+     relays_update_in_flight = false;
+     if (result == 0) {
+          // Only the relays not changed again since the update was sent are acknowledged
+          relays_pending_mask &= ~(relays_sent_mask & ~(relays_pending_values ^ relays_sent_values));
+     }
+     bool pending = relays_pending_mask != 0;
+     k_spin_unlock(&relays_update_lock, key);
+
+     if (result != 0) {
+          printk("THREAD [ERROR]: Relays update not acknowledged by server (error: %d), retrying\r\n", result);
+          k_work_reschedule(&relays_update_work, K_MSEC(RELAYS_UPDATE_RETRY_MS));
+          return;
+     }
+     server_reply_received(from);
+
+     if (pending) {
+          k_work_reschedule(&relays_update_work, K_NO_WAIT);
+     }
+}
+
+/* Send the pending relays to the server, once attached and with no other update in flight */
+static void send_relays_update(struct k_work *item)
+{
+     static const char hex_digits[] = "0123456789abcdef";
+     char payload[] = RELAYS_MASK_PAYLOAD_PREFIX "MV";
+     uint16_t prefix_len = strlen(RELAYS_MASK_PAYLOAD_PREFIX);
+
+     ARG_UNUSED(item);
+
+     if (!server_discovery_is_attached()) {
+          return;
+     }
+
+     k_spinlock_key_t key = k_spin_lock(&relays_update_lock);
+     bool send = !relays_update_in_flight && (relays_pending_mask != 0);
+     if (send) {
+          relays_sent_mask = relays_pending_mask;
+          relays_sent_values = relays_pending_values;
+          relays_update_in_flight = true;
+     }
+     k_spin_unlock(&relays_update_lock, key);
+
+     if (!send) {
+          return;
+     }
+
+     payload[prefix_len] = hex_digits[relays_sent_mask & 0x0f];
+     payload[prefix_len + 1] = hex_digits[relays_sent_values & 0x0f];
+
+     printk("THREAD [DEBBUG]: Sending relays update to server: %s\r\n", payload);
+     if (server_request_send(OT_COAP_CODE_PUT, POWER_STRIP_URI_PATH, (const uint8_t *)payload, strlen(payload),
+                             on_relays_update_reply)) {
+          key = k_spin_lock(&relays_update_lock);
+          relays_update_in_flight = false;
+          k_spin_unlock(&relays_update_lock, key);
+          k_work_reschedule(&relays_update_work, K_MSEC(RELAYS_UPDATE_RETRY_MS));
+     }
 }
 
 static void send_keep_alive(struct k_work *item)
@@ -130,9 +277,7 @@ static void send_keep_alive(struct k_work *item)
      static uint8_t msg_buf[] = KEEP_ALIVE_DEVICE_ID_7;
      uint16_t msg_len = sizeof(msg_buf);
 
-     int ret_coap_req = coap_send_request(
-          COAP_METHOD_PUT,(const struct sockaddr *)&multicast_local_addr,
-          commands_option, &msg_buf, msg_len, on_commands_msg_reply);
+     int ret_coap_req = server_request_send(OT_COAP_CODE_PUT, COMMANDS_URI_PATH, msg_buf, msg_len, on_commands_msg_reply);
      
      dk_set_led_on(COMMANDS_MSG_LED);
 }
@@ -143,12 +288,20 @@ static void send_power_strip_status_request(struct k_work *item)
 
      printk("THREAD [DEBBUG]: Sending power strip status request to server \r\n");
 
-     coap_send_request(COAP_METHOD_GET,
-                 (const struct sockaddr *)&multicast_local_addr,
-                 power_strip_status_option, NULL, 0u, on_power_strip_status_reply);
+     server_status_request_send(POWER_STRIP_URI_PATH, on_power_strip_status_reply);
+     // Reported as timed out unless the reply arrives first
+     atomic_set(&status_reply_result, -ETIMEDOUT);
+     k_work_reschedule(&status_reply_work, K_MSEC(CONFIG_CLIENT_STATUS_REPLY_TIMEOUT_MS));
      dk_set_led_on(RESSOURCES_STATUS_MSG_LED);
 }
 
+void set_server_relays_status(bool r1_status, bool r2_status, bool r3_status, bool r4_status){
+     srv_ressources.r1_status = r1_status;
+     srv_ressources.r2_status = r2_status;
+     srv_ressources.r3_status = r3_status;
+     srv_ressources.r4_status = r4_status;
+}
+
 bool get_server_r1_status(void){
      return srv_ressources.r1_status;
 }
@@ -165,61 +318,601 @@ bool get_server_r4_status(void){
      return srv_ressources.r4_status;
 }
 
+/* Caching proxy: the status responses of the server are served to the children of this router */
+#define PROXY_PAYLOAD_MAX_SIZE 64
+#define PROXY_ETAG_MAX_SIZE 8
+#define PROXY_PENDING_REQUESTS_MAX 4
+#define PROXY_DEFAULT_MAX_AGE_S 60
+
+/* Request of a child waiting for the server response */
+struct proxy_pending_request {
+     uint8_t token[OT_COAP_MAX_TOKEN_LENGTH];
+     uint8_t token_len;
+     otMessageInfo msg_info;
+};
+
+struct proxy_cache_entry {
+     otCoapResource resource;
+     bool valid;
+     bool fetching;
+     int64_t expiry_time;
+     uint8_t etag[PROXY_ETAG_MAX_SIZE];
+     uint8_t etag_len;
+     uint8_t payload[PROXY_PAYLOAD_MAX_SIZE];
+     uint16_t payload_len;
+     struct proxy_pending_request pending[PROXY_PENDING_REQUESTS_MAX];
+     uint8_t pending_count;
+     // Upstream requests sent and completed, a late completion of a timed out request is ignored
+     uint32_t fetches_sent;
+     uint32_t fetches_done;
+     struct k_work_delayable fetch_timeout_work;
+};
+
+static struct proxy_cache_entry proxy_cache[] = {
+     { .resource = { .mUriPath = RESSOURCES_URI_PATH } },
+     { .resource = { .mUriPath = POWER_STRIP_URI_PATH } },
+};
+
+static uint32_t proxy_hits;
+static uint32_t proxy_misses;
+
+/* Answer a child, piggybacked in the acknowledgment when its request message is confirmable */
+static void proxy_response_send(otInstance *ot, struct proxy_cache_entry *entry,
+                        const struct proxy_pending_request *request, const otMessage *request_message,
+                        otCoapCode code)
+{
+     otError error = OT_ERROR_NO_BUFS;
+     otMessage *response;
+
+     response = otCoapNewMessage(ot, NULL);
+     if (response == NULL) {
+          goto end;
+     }
+
+     if ((request_message != NULL) && (otCoapMessageGetType(request_message) == OT_COAP_TYPE_CONFIRMABLE)) {
+          error = otCoapMessageInitResponse(response, request_message, OT_COAP_TYPE_ACKNOWLEDGMENT, code);
+     } else {
+          otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE, code);
+          error = otCoapMessageSetToken(response, request->token, request->token_len);
+     }
+     if (error != OT_ERROR_NONE) {
+          goto end;
+     }
+
+     if (code == OT_COAP_CODE_CONTENT) {
+          // Remaining freshness lifetime of the cached copy
+          int64_t max_age_ms = MAX(entry->expiry_time - k_uptime_get(), 0);
+
+          error = otCoapMessageAppendOption(response, OT_COAP_OPTION_E_TAG, entry->etag_len, entry->etag);
+          if (error != OT_ERROR_NONE) {
+               goto end;
+          }
+          error = otCoapMessageAppendMaxAgeOption(response, (uint32_t)(max_age_ms / 1000));
+          if (error != OT_ERROR_NONE) {
+               goto end;
+          }
+          error = otCoapMessageSetPayloadMarker(response);
+          if (error != OT_ERROR_NONE) {
+               goto end;
+          }
+          error = otMessageAppend(response, entry->payload, entry->payload_len);
+          if (error != OT_ERROR_NONE) {
+               goto end;
+          }
+     }
+
+     error = otCoapSendResponse(ot, response, &request->msg_info);
+
+end:
+     if (error != OT_ERROR_NONE && response != NULL) {
+          otMessageFree(response);
+     }
+}
+
+/* Acknowledge a confirmable request answered later by a separate response */
+static void proxy_empty_ack_send(otInstance *ot, const otMessage *request_message,
+                         const otMessageInfo *message_info)
+{
+     otError error = OT_ERROR_NO_BUFS;
+     otMessage *ack;
+
+     if (otCoapMessageGetType(request_message) != OT_COAP_TYPE_CONFIRMABLE) {
+          return;
+     }
+
+     ack = otCoapNewMessage(ot, NULL);
+     if (ack == NULL) {
+          goto end;
+     }
+
+     error = otCoapMessageInitResponse(ack, request_message, OT_COAP_TYPE_ACKNOWLEDGMENT, OT_COAP_CODE_EMPTY);
+     if (error != OT_ERROR_NONE) {
+          goto end;
+     }
+
+     error = otCoapSendResponse(ot, ack, message_info);
+
+end:
+     if (error != OT_ERROR_NONE && ack != NULL) {
+          otMessageFree(ack);
+     }
+}
+
+/* Answer the children waiting for the server response */
+static void proxy_pending_requests_answer(otInstance *ot, struct proxy_cache_entry *entry)
+{
+     otCoapCode code = entry->valid ? OT_COAP_CODE_CONTENT : OT_COAP_CODE_GATEWAY_TIMEOUT;
+
+     for (int i = 0; i < entry->pending_count; i++) {
+          proxy_response_send(ot, entry, &entry->pending[i], NULL, code);
+     }
+     entry->pending_count = 0;
+}
+
+static void proxy_upstream_response_handler(void *context, otMessage *message,
+                                  const otMessageInfo *message_info, otError result)
+{
+     struct proxy_cache_entry *entry = context;
+     otInstance *ot = openthread_get_default_instance();
+     otCoapOptionIterator iterator;
+     const otCoapOption *option;
+     uint64_t max_age = PROXY_DEFAULT_MAX_AGE_S;
+
+     ARG_UNUSED(message_info);
+
+     entry->fetches_done ++;
+
+     if (result != OT_ERROR_NONE) {
+          printk("THREAD [ERROR]: Proxy %s request failed, error: %d\r\n", entry->resource.mUriPath, result);
+          // The children of a request already timed out wait for a newer one
+          if (entry->fetches_done != entry->fetches_sent) {
+               return;
+          }
+          goto exit;
+     }
+
+     if (otCoapOptionIteratorInit(&iterator, message) == OT_ERROR_NONE) {
+          if (otCoapOptionIteratorGetFirstOptionMatching(&iterator, OT_COAP_OPTION_MAX_AGE) != NULL) {
+               otCoapOptionIteratorGetOptionUintValue(&iterator, &max_age);
+          }
+
+          option = otCoapOptionIteratorGetFirstOptionMatching(&iterator, OT_COAP_OPTION_E_TAG);
+          if ((option != NULL) && (option->mLength <= PROXY_ETAG_MAX_SIZE) &&
+              (otCoapOptionIteratorGetOptionValue(&iterator, entry->etag) == OT_ERROR_NONE)) {
+               entry->etag_len = option->mLength;
+          }
+     }
+
+     switch (otCoapMessageGetCode(message)) {
+     case OT_COAP_CODE_CONTENT:
+          entry->payload_len = otMessageRead(message, otMessageGetOffset(message),
+                                     entry->payload, PROXY_PAYLOAD_MAX_SIZE);
+          entry->valid = true;
+          entry->expiry_time = k_uptime_get() + max_age * MSEC_PER_SEC;
+          break;
+
+     case OT_COAP_CODE_VALID:
+          // Cached copy still matches the server state
+          entry->expiry_time = k_uptime_get() + max_age * MSEC_PER_SEC;
+          break;
+
+     default:
+          printk("THREAD [ERROR]: Proxy %s unexpected response code\r\n", entry->resource.mUriPath);
+          break;
+     }
+
+     printk("THREAD [DEBBUG]: Proxy %s refreshed from server (hits: %d misses: %d)\r\n",
+            entry->resource.mUriPath, proxy_hits, proxy_misses);
+
+exit:
+     entry->fetching = entry->fetches_done != entry->fetches_sent;
+     if (!entry->fetching) {
+          k_work_cancel_delayable(&entry->fetch_timeout_work);
+     }
+     proxy_pending_requests_answer(ot, entry);
+}
+
+/* The server did not answer in time: the waiting children get a 5.04 and the next request fetches again */
+static void proxy_fetch_timeout(struct k_work *item)
+{
+     struct k_work_delayable *dwork = k_work_delayable_from_work(item);
+     struct proxy_cache_entry *entry = CONTAINER_OF(dwork, struct proxy_cache_entry, fetch_timeout_work);
+     otInstance *ot = openthread_get_default_instance();
+
+     openthread_api_mutex_lock(openthread_get_default_context());
+     if (entry->fetching) {
+          printk("THREAD [ERROR]: Proxy %s no server response within %d ms\r\n", entry->resource.mUriPath,
+                 CONFIG_CLIENT_CACHING_PROXY_UPSTREAM_TIMEOUT_MS);
+          entry->fetching = false;
+          proxy_pending_requests_answer(ot, entry);
+     }
+     openthread_api_mutex_unlock(openthread_get_default_context());
+}
+
+/* Fetch the resource from the server, revalidating the cached copy if any */
+static otError proxy_upstream_request_send(otInstance *ot, struct proxy_cache_entry *entry)
+{
+     otError error = OT_ERROR_NO_BUFS;
+     otMessage *request;
+     otMessageInfo message_info;
+
+     memset(&message_info, 0, sizeof(message_info));
+
+     server_destination_get(&message_info.mPeerAddr, &message_info.mPeerPort);
+
+     request = otCoapNewMessage(ot, NULL);
+     if (request == NULL) {
+          goto end;
+     }
+
+     otCoapMessageInit(request, OT_COAP_TYPE_NON_CONFIRMABLE, OT_COAP_CODE_GET);
+     otCoapMessageGenerateToken(request, OT_COAP_DEFAULT_TOKEN_LENGTH);
+
+     // Options in increasing number order: ETag (4) then Uri-Path (11)
+     if (entry->valid && (entry->etag_len > 0)) {
+          error = otCoapMessageAppendOption(request, OT_COAP_OPTION_E_TAG, entry->etag_len, entry->etag);
+          if (error != OT_ERROR_NONE) {
+               goto end;
+          }
+     }
+
+     error = otCoapMessageAppendUriPathOptions(request, entry->resource.mUriPath);
+     if (error != OT_ERROR_NONE) {
+          goto end;
+     }
+
+     error = otCoapSendRequest(ot, request, &message_info, proxy_upstream_response_handler, entry);
+
+end:
+     if (error != OT_ERROR_NONE && request != NULL) {
+          otMessageFree(request);
+     }
+     return error;
+}
+
+static void proxy_request_handler(void *context, otMessage *message,
+                          const otMessageInfo *message_info)
+{
+     struct proxy_cache_entry *entry = context;
+     otInstance *ot = openthread_get_default_instance();
+     struct proxy_pending_request request;
+
+     if (otCoapMessageGetCode(message) != OT_COAP_CODE_GET) {
+          return;
+     }
+
+     request.token_len = otCoapMessageGetTokenLength(message);
+     memcpy(request.token, otCoapMessageGetToken(message), request.token_len);
+     request.msg_info = *message_info;
+     memset(&request.msg_info.mSockAddr, 0, sizeof(request.msg_info.mSockAddr));
+
+     // Fresh copy: answer locally
+     if (entry->valid && (k_uptime_get() < entry->expiry_time)) {
+          proxy_hits ++;
+          proxy_response_send(ot, entry, &request, message, OT_COAP_CODE_CONTENT);
+          return;
+     }
+
+     proxy_misses ++;
+     if (entry->pending_count >= PROXY_PENDING_REQUESTS_MAX) {
+          printk("THREAD [ERROR]: Proxy %s too many pending requests\r\n", entry->resource.mUriPath);
+          return;
+     }
+     entry->pending[entry->pending_count++] = request;
+     proxy_empty_ack_send(ot, message, message_info);
+
+     // A single request to the server for all the waiting children
+     if (!entry->fetching) {
+          if (proxy_upstream_request_send(ot, entry) == OT_ERROR_NONE) {
+               entry->fetching = true;
+               entry->fetches_sent ++;
+               k_work_reschedule(&entry->fetch_timeout_work, K_MSEC(CONFIG_CLIENT_CACHING_PROXY_UPSTREAM_TIMEOUT_MS));
+          } else {
+               proxy_pending_requests_answer(ot, entry);
+          }
+     }
+}
+
+/* Advertise the caching proxy in Thread Network Data while this node is a router */
+static void proxy_service_update(otInstance *ot, bool advertise)
+{
+     otServiceConfig config;
+     otError error;
+
+     if (advertise) {
+          memset(&config, 0, sizeof(config));
+          config.mEnterpriseNumber = SERVICE_ENTERPRISE_NUMBER;
+          config.mServiceDataLength = strlen(PROXY_SERVICE_NAME);
+          memcpy(config.mServiceData, PROXY_SERVICE_NAME, config.mServiceDataLength);
+          config.mServerConfig.mStable = false;
+          error = otServerAddService(ot, &config);
+     } else {
+          error = otServerRemoveService(ot, SERVICE_ENTERPRISE_NUMBER, PROXY_SERVICE_NAME,
+                                  strlen(PROXY_SERVICE_NAME));
+     }
+
+     if (error == OT_ERROR_NONE) {
+          error = otServerRegister(ot);
+          printk("THREAD [DEBBUG]: Caching proxy %s\r\n", advertise ? "advertised" : "withdrawn");
+     }
+     if ((error != OT_ERROR_NONE) && (error != OT_ERROR_ALREADY) && (error != OT_ERROR_NOT_FOUND)) {
+          printk("THREAD [ERROR]: Cannot update caching proxy service, error: %d\r\n", error);
+     }
+}
+
 static void on_thread_state_changed(otChangedFlags flags, struct openthread_context *ot_context,
                         void *user_data)
 {
+     bool attached = false;
+
      if (flags & OT_CHANGED_THREAD_ROLE) {
           switch (otThreadGetDeviceRole(ot_context->instance)) {
           case OT_DEVICE_ROLE_CHILD:
           case OT_DEVICE_ROLE_ROUTER:
           case OT_DEVICE_ROLE_LEADER:
+               if (server_discovery_attached()) {
+                    attached = true;
+                    // The server learns the address of this node from its keep alive msgs
+                    keep_alives_skipped = CONFIG_CLIENT_KEEP_ALIVE_SKIP_MAX;
+               }
+               if (on_downlink_request != NULL) {
+                    server_discovery_groups_subscribe(ot_context->instance, CLIENT_CLASS_GROUP_ID,
+                                                      CONFIG_CLIENT_ROOM_GROUP_ID);
+               }
+               if (IS_ENABLED(CONFIG_CLIENT_CACHING_PROXY)) {
+                    proxy_service_update(ot_context->instance,
+                                   otThreadGetDeviceRole(ot_context->instance) != OT_DEVICE_ROLE_CHILD);
+               }
                k_work_submit(&on_connect_work);
-               is_connected = true;
                break;
 
           case OT_DEVICE_ROLE_DISABLED:
           case OT_DEVICE_ROLE_DETACHED:
           default:
+               server_discovery_detached();
                k_work_submit(&on_disconnect_work);
-               is_connected = false;
                break;
           }
      }
+
+     // Resolve the server once attached and whenever the network data or the parent changes
+     if ((flags & (OT_CHANGED_THREAD_ROLE | OT_CHANGED_THREAD_NETDATA | OT_CHANGED_THREAD_RLOC_ADDED)) &&
+         server_discovery_is_attached()) {
+          server_discovery_resolve(ot_context->instance);
+     }
+
+     // Requests made while detached, sent once the server is resolved
+     if (attached) {
+          offline_queue_flush(server_offline_request_send);
+          k_work_reschedule(&relays_update_work, K_NO_WAIT);
+     }
+}
+
+static void downlink_response_send(otMessage *request_message,
+                      const otMessageInfo *message_info)
+{
+     otError error = OT_ERROR_NO_BUFS;
+     otMessage *response;
+     otInstance *ot = openthread_get_default_instance();
+
+     response = otCoapNewMessage(ot, NULL);
+     if (response == NULL) {
+          goto end;
+     }
+
+     error = otCoapMessageInitResponse(response, request_message,
+                           OT_COAP_TYPE_ACKNOWLEDGMENT, OT_COAP_CODE_CHANGED);
+     if (error != OT_ERROR_NONE) {
+          goto end;
+     }
+
+     error = otCoapSendResponse(ot, response, message_info);
+
+end:
+     if (error != OT_ERROR_NONE && response != NULL) {
+          otMessageFree(response);
+     }
+}
+
+static void downlink_request_handler(void *context, otMessage *message,
+                      const otMessageInfo *message_info)
+{
+     uint8_t payload[DOWNLINK_PAYLOAD_MAX_SIZE + 1];
+     uint16_t payload_len;
+
+     ARG_UNUSED(context);
+
+     if (otCoapMessageGetCode(message) != OT_COAP_CODE_PUT) {
+          printk("THREAD [ERROR]: Downlink handler - Unexpected CoAP code\r\n");
+          return;
+     }
+
+     payload_len = otMessageRead(message, otMessageGetOffset(message), payload, DOWNLINK_PAYLOAD_MAX_SIZE);
+     payload[payload_len] = '\0';
+
+     printk("THREAD [DEBBUG]: Downlink request received: %s\r\n", payload);
+
+     // Multicast group requests are non confirmable and not answered
+     if (otCoapMessageGetType(message) == OT_COAP_TYPE_CONFIRMABLE) {
+          downlink_response_send(message, message_info);
+     }
+
+     if (on_downlink_request != NULL) {
+          on_downlink_request(payload, payload_len);
+     }
+}
+
+/* Status changed on the server: fetch the new state by unicast when its version changed */
+static void notify_request_handler(void *context, otMessage *message,
+                      const otMessageInfo *message_info)
+{
+     char payload[sizeof(NOTIFY_VERSION_PREFIX) + 10];
+     uint16_t payload_len;
+     uint32_t version;
+
+     ARG_UNUSED(context);
+     ARG_UNUSED(message_info);
+
+     payload_len = otMessageRead(message, otMessageGetOffset(message), payload, sizeof(payload) - 1);
+     payload[payload_len] = '\0';
+
+     if (strncmp(payload, NOTIFY_VERSION_PREFIX, strlen(NOTIFY_VERSION_PREFIX)) != 0) {
+          return;
+     }
+
+     version = strtoul(payload + strlen(NOTIFY_VERSION_PREFIX), NULL, 10);
+     if (version == status_version) {
+          return;
+     }
+     if ((status_version != 0) && (version != status_version + 1)) {
+          printk("THREAD [DEBBUG]: %d status notifications missed\r\n", version - status_version - 1);
+     }
+     status_version = version;
+
+     // Cached copies older than the notified version are expired
+     for (int i = 0; i < ARRAY_SIZE(proxy_cache); i++) {
+          if ((proxy_cache[i].etag_len != sizeof(uint32_t)) ||
+              (sys_get_be32(proxy_cache[i].etag) != version)) {
+               proxy_cache[i].expiry_time = 0;
+          }
+     }
+
+     if (server_discovery_is_attached()) {
+          k_work_submit(&power_strip_status_work);
+     }
+}
+
+static void status_reply_handler(struct k_work *item)
+{
+     int result = atomic_get(&status_reply_result);
+
+     ARG_UNUSED(item);
+
+     if (result != 0) {
+          printk("THREAD [ERROR]: No status reply within %d ms\r\n", CONFIG_CLIENT_STATUS_REPLY_TIMEOUT_MS);
+     }
+     if (on_status_reply != NULL) {
+          on_status_reply(result, (result == 0) && atomic_get(&status_reply_changed));
+     }
 }
 
 static struct openthread_state_changed_cb ot_state_chaged_cb = {
      .state_changed_cb = on_thread_state_changed
 };
 
-static void submit_work_if_connected(struct k_work *work)
-{         
-     if (is_connected) {
-          k_work_submit(work);
-     } else {
-          printk("THREAD [ERROR]: Connection is broken \r\n");
-     }
+void coap_client_status_reply_cb_set(status_reply_cb_t callback)
+{
+     on_status_reply = callback;
 }
 
-void coap_client_utils_init(ot_connection_cb_t on_connect, ot_disconnection_cb_t on_disconnect)
+uint32_t coap_client_device_hash(void)
 {
+     return server_discovery_device_hash();
+}
 
-     coap_init(AF_INET6, NULL);
+void coap_client_utils_init(ot_connection_cb_t on_connect, ot_disconnection_cb_t on_disconnect)
+{
+     otError error;
 
      k_work_init(&on_connect_work, on_connect);
      k_work_init(&on_disconnect_work, on_disconnect);
+     k_work_init_delayable(&status_reply_work, status_reply_handler);
      k_work_init(&send_keep_alive_work, send_keep_alive);
      k_work_init(&power_strip_status_work, send_power_strip_status_request);
+     k_work_init_delayable(&relays_update_work, send_relays_update);
+
+     openthread_api_mutex_lock(openthread_get_default_context());
+     server_discovery_init(openthread_get_default_instance());
+     error = otCoapStart(openthread_get_default_instance(), COAP_PORT);
+     openthread_api_mutex_unlock(openthread_get_default_context());
+
+     if (error != OT_ERROR_NONE) {
+          printk("THREAD [ERROR]: Cannot start CoAP, error: %d\r\n", error);
+     }
+     request_manager_init();
 
      openthread_state_changed_cb_register(openthread_get_default_context(), &ot_state_chaged_cb);
      openthread_start(openthread_get_default_context());
 }
 
+int coap_client_downlink_init(downlink_request_cb_t callback)
+{
+     otInstance *ot = openthread_get_default_instance();
+
+     on_downlink_request = callback;
+
+     openthread_api_mutex_lock(openthread_get_default_context());
+
+     downlink_resource.mContext = ot;
+     downlink_resource.mHandler = downlink_request_handler;
+     otCoapAddResource(ot, &downlink_resource);
+
+     notify_resource.mContext = ot;
+     notify_resource.mHandler = notify_request_handler;
+     otCoapAddResource(ot, &notify_resource);
+
+     openthread_api_mutex_unlock(openthread_get_default_context());
+
+     return 0;
+}
+
+int coap_client_caching_proxy_init(void)
+{
+     otInstance *ot = openthread_get_default_instance();
+
+     if (!IS_ENABLED(CONFIG_CLIENT_CACHING_PROXY)) {
+          return 0;
+     }
+
+     openthread_api_mutex_lock(openthread_get_default_context());
+
+     for (int i = 0; i < ARRAY_SIZE(proxy_cache); i++) {
+          proxy_cache[i].resource.mContext = &proxy_cache[i];
+          proxy_cache[i].resource.mHandler = proxy_request_handler;
+          k_work_init_delayable(&proxy_cache[i].fetch_timeout_work, proxy_fetch_timeout);
+          otCoapAddResource(ot, &proxy_cache[i].resource);
+     }
+
+     openthread_api_mutex_unlock(openthread_get_default_context());
+
+     return 0;
+}
+
 void coap_client_send_keep_alive(void)
 {
-     submit_work_if_connected(&send_keep_alive_work);
+     atomic_val_t requests = server_requests_count();
+
+     // The requests sent to the server during the last period already prove this node is alive
+     if ((requests != server_requests_at_keep_alive) && (keep_alives_skipped < CONFIG_CLIENT_KEEP_ALIVE_SKIP_MAX)) {
+          server_requests_at_keep_alive = requests;
+          keep_alives_skipped ++;
+          keep_alives_suppressed ++;
+          printk("THREAD [DEBBUG]: Keep alive suppressed (sent: %d suppressed: %d)\r\n",
+                 keep_alives_sent, keep_alives_suppressed);
+          return;
+     }
+
+     // Not counting the keep alive msg itself
+     server_requests_at_keep_alive = requests + 1;
+     keep_alives_skipped = 0;
+     keep_alives_sent ++;
+
+     server_work_submit_or_queue(&send_keep_alive_work, OFFLINE_PRIORITY_KEEP_ALIVE, OT_COAP_CODE_PUT, COMMANDS_URI_PATH,
+                                 (const uint8_t *)KEEP_ALIVE_DEVICE_ID_7, sizeof(KEEP_ALIVE_DEVICE_ID_7), on_commands_msg_reply);
 }
 
 void coap_client_send_power_strip_status_request(void)
 {
-     submit_work_if_connected(&power_strip_status_work);
-}
\ No newline at end of file
+     server_work_submit_or_queue(&power_strip_status_work, OFFLINE_PRIORITY_STATUS, OT_COAP_CODE_GET, POWER_STRIP_URI_PATH,
+                                 NULL, 0u, on_power_strip_status_reply);
+}
+
+void coap_client_send_relays_update(uint8_t mask, uint8_t values)
+{
+     k_spinlock_key_t key = k_spin_lock(&relays_update_lock);
+     relays_pending_mask |= mask & 0x0f;
+     relays_pending_values = (relays_pending_values & ~mask) | (values & mask);
+     k_spin_unlock(&relays_update_lock, key);
+
+     k_work_reschedule(&relays_update_work, K_NO_WAIT);
+}
@@ -26,11 +26,47 @@ typedef void (*ot_connection_cb_t)(struct k_work *item);
  */
 typedef void (*ot_disconnection_cb_t)(struct k_work *item);
 
+/** @brief Type indicates function called when a downlink request is received
+ *         from the CoAP server node.
+ *
+ * @param[in] payload NULL terminated request payload.
+ * @param[in] payload_len request payload length.
+ */
+typedef void (*downlink_request_cb_t)(const uint8_t *payload, uint16_t payload_len);
+
+/** @brief Type indicates function called when a periodic status request completes.
+ *
+ * @param[in] result 0 when the status was updated from the reply, -ETIMEDOUT
+ *                   when no reply arrived in time.
+ * @param[in] changed true if the reply changed the known status.
+ */
+typedef void (*status_reply_cb_t)(int result, bool changed);
+
 /** @brief Initialize CoAP client utilities.
  */
 void coap_client_utils_init(ot_connection_cb_t on_connect,
                    ot_disconnection_cb_t on_disconnect);
 
+/** @brief Set the function called from the system workqueue when a status request
+ *         completes, as soon as its reply arrives.
+ */
+void coap_client_status_reply_cb_set(status_reply_cb_t callback);
+
+/** @brief Returns a hash of the EUI-64 of this node, valid once the CoAP client
+ *         utilities are initialized.
+ */
+uint32_t coap_client_device_hash(void);
+
+/** @brief Expose the downlink resource used by the CoAP server node to send
+ *         requests and status change notifications to this client.
+ */
+int coap_client_downlink_init(downlink_request_cb_t on_downlink_request);
+
+/** @brief Expose the status resources answered from the cache of this node to its
+ *         children, when CONFIG_CLIENT_CACHING_PROXY is enabled.
+ */
+int coap_client_caching_proxy_init(void);
+
 /** @brief Request for post keep alive msg.
  *
  */
@@ -41,6 +77,20 @@ void coap_client_send_keep_alive(void);
  */
 void coap_client_send_power_strip_status_request(void);
 
+/** @brief Report to the server the relays changed locally.
+ *
+ * The relays set in mask take their bit in values, bit n for relay n+1. They stay pending,
+ * and override the relays status polled from the server, until the server acknowledged
+ * them: an update not acknowledged is sent again, and an update made while detached is
+ * sent once the client attaches again.
+ */
+void coap_client_send_relays_update(uint8_t mask, uint8_t values);
+
+/** @brief Set the orchestrator relays status received in a downlink request.
+ *
+ */
+void set_server_relays_status(bool r1_status, bool r2_status, bool r3_status, bool r4_status);
+
 /** @brief Returns the orchestrator r1 status.
  *
  */
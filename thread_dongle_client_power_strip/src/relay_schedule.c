@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <thread_dongle_interface.h>
+#include <relays_mask.h>
+
+#include "relay_schedule.h"
+
+#define SECOND_MS 1000
+#define DAY_SECONDS (24 * 60 * 60)
+#define DAY_MS (DAY_SECONDS * SECOND_MS)
+
+// Time of the day HHMMSS, then one record per entry: HHMMSSMV
+#define TIME_SIZE 6
+#define ENTRY_SIZE (TIME_SIZE + 2)
+
+// The largest schedule must fit in a single downlink payload
+BUILD_ASSERT(sizeof(SCHEDULE_PAYLOAD_PREFIX) - 1 + TIME_SIZE + CONFIG_RELAY_SCHEDULE_ENTRIES * (1 + ENTRY_SIZE) <=
+             DOWNLINK_PAYLOAD_MAX_SIZE, "RELAY_SCHEDULE_ENTRIES do not fit in a downlink payload");
+
+static struct relay_schedule_entry schedule_entries[CONFIG_RELAY_SCHEDULE_ENTRIES];
+static uint8_t schedule_entries_count;
+static relay_schedule_cb_t on_schedule_due;
+static struct k_work_delayable schedule_work;
+static K_MUTEX_DEFINE(schedule_mutex);
+
+// Time of the day in ms at the uptime of the last set
+static uint32_t clock_day_ms;
+static int64_t clock_uptime;
+static bool clock_set;
+
+/* Second of the day from HHMMSS, negative if malformed */
+static int32_t second_parse(const char *time)
+{
+     for (int i = 0; i < TIME_SIZE; i++) {
+          if ((time[i] < '0') || (time[i] > '9')) {
+               return -1;
+          }
+     }
+
+     int hours = (time[0] - '0') * 10 + (time[1] - '0');
+     int minutes = (time[2] - '0') * 10 + (time[3] - '0');
+     int seconds = (time[4] - '0') * 10 + (time[5] - '0');
+     if ((hours > 23) || (minutes > 59) || (seconds > 59)) {
+          return -1;
+     }
+     return (hours * 60 + minutes) * 60 + seconds;
+}
+
+/* Must be called with the schedule mutex held */
+static uint32_t day_ms_get(void)
+{
+     return (clock_day_ms + (uint64_t)(k_uptime_get() - clock_uptime)) % DAY_MS;
+}
+
+/* Wait for the next entry due, must be called with the schedule mutex held */
+static void schedule_next(void)
+{
+     uint32_t next_ms = DAY_MS;
+
+     if (!clock_set || (schedule_entries_count == 0)) {
+          k_work_cancel_delayable(&schedule_work);
+          return;
+     }
+
+     uint32_t now_ms = day_ms_get();
+     for (int i = 0; i < schedule_entries_count; i++) {
+          uint32_t delay_ms = (schedule_entries[i].second * SECOND_MS + DAY_MS - now_ms) % DAY_MS;
+          if (delay_ms == 0) {
+               delay_ms = DAY_MS;
+          }
+          next_ms = MIN(next_ms, delay_ms);
+     }
+
+     k_work_reschedule(&schedule_work, K_MSEC(next_ms));
+}
+
+static void schedule_due(struct k_work *item)
+{
+     uint8_t mask = 0;
+     uint8_t values = 0;
+
+     ARG_UNUSED(item);
+
+     k_mutex_lock(&schedule_mutex, K_FOREVER);
+
+     uint32_t second = day_ms_get() / SECOND_MS;
+     for (int i = 0; i < schedule_entries_count; i++) {
+          const struct relay_schedule_entry *entry = &schedule_entries[i];
+
+          if (entry->second == second) {
+               values = (values & ~entry->mask) | (entry->values & entry->mask);
+               mask |= entry->mask;
+          }
+     }
+     schedule_next();
+
+     k_mutex_unlock(&schedule_mutex);
+
+     if ((mask != 0) && (on_schedule_due != NULL)) {
+          printk("SCHEDULE [DEBBUG]: %02d:%02d:%02d relays mask: %x values: %x\r\n",
+                 second / 3600, (second / 60) % 60, second % 60, mask, values);
+          on_schedule_due(mask, values);
+     }
+}
+
+int relay_schedule_set(const char *payload, uint16_t payload_len)
+{
+     struct relay_schedule_entry entries[CONFIG_RELAY_SCHEDULE_ENTRIES];
+     uint16_t prefix_len = strlen(SCHEDULE_PAYLOAD_PREFIX);
+     uint8_t count = 0;
+
+     if ((payload_len < prefix_len + TIME_SIZE) || (strncmp(payload, SCHEDULE_PAYLOAD_PREFIX, prefix_len) != 0)) {
+          return -EINVAL;
+     }
+
+     int32_t now_second = second_parse(&payload[prefix_len]);
+     if (now_second < 0) {
+          return -EINVAL;
+     }
+
+     for (uint16_t offset = prefix_len + TIME_SIZE; offset < payload_len; offset += 1 + ENTRY_SIZE) {
+          const char *record = &payload[offset + 1];
+
+          if ((payload[offset] != COMMANDS_RECORD_SEPARATOR) || (payload_len - offset - 1 < ENTRY_SIZE)) {
+               return -EINVAL;
+          }
+          if (count == ARRAY_SIZE(entries)) {
+               return -ENOMEM;
+          }
+
+          int32_t second = second_parse(record);
+          int mask = hex_digit_get(record[TIME_SIZE]);
+          int values = hex_digit_get(record[TIME_SIZE + 1]);
+          if ((second < 0) || (mask < 0) || (values < 0)) {
+               return -EINVAL;
+          }
+
+          entries[count].second = second;
+          entries[count].mask = mask;
+          entries[count].values = values;
+          count ++;
+     }
+
+     k_mutex_lock(&schedule_mutex, K_FOREVER);
+
+     memcpy(schedule_entries, entries, count * sizeof(entries[0]));
+     schedule_entries_count = count;
+     clock_day_ms = now_second * SECOND_MS;
+     clock_uptime = k_uptime_get();
+     clock_set = true;
+     schedule_next();
+
+     k_mutex_unlock(&schedule_mutex);
+
+     printk("SCHEDULE [DEBBUG]: Clock set to %02d:%02d:%02d, %d schedule entries\r\n",
+            now_second / 3600, (now_second / 60) % 60, now_second % 60, count);
+     return 0;
+}
+
+void relay_schedule_init(relay_schedule_cb_t callback)
+{
+     on_schedule_due = callback;
+     k_work_init_delayable(&schedule_work, schedule_due);
+}
@@ -0,0 +1,55 @@
+/**
+ * @file
+ * @defgroup relay_schedule Relays switched locally at scheduled times of the day
+ * @{
+ */
+
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __RELAY_SCHEDULE_H__
+#define __RELAY_SCHEDULE_H__
+
+#include <zephyr/kernel.h>
+
+/* Schedule entry: at second of the day, the relays set in mask take their bit in values */
+struct relay_schedule_entry {
+     uint32_t second;
+     uint8_t mask;
+     uint8_t values;
+};
+
+/** @brief Type indicates function called when schedule entries are due, from the system workqueue.
+ *
+ * @param[in] mask relays to change, bit n for relay n+1.
+ * @param[in] values new status of the relays to change.
+ */
+typedef void (*relay_schedule_cb_t)(uint8_t mask, uint8_t values);
+
+/** @brief Initialize the relays schedule, empty until set.
+ *
+ * @param[in] callback function called when schedule entries are due.
+ */
+void relay_schedule_init(relay_schedule_cb_t callback);
+
+/** @brief Set the clock and replace the schedule from a payload: sched:HHMMSS[;HHMMSSMV...]
+ *
+ * HHMMSS is the current time of the day, then each entry is a time of the day
+ * followed by a relays mask M and their values V, one hex digit each. The
+ * entries due at the same second are applied in order. The clock runs from
+ * the uptime of the node until the next set.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if the payload is malformed, the schedule is then unchanged.
+ * @retval -ENOMEM if there are more than CONFIG_RELAY_SCHEDULE_ENTRIES entries.
+ */
+int relay_schedule_set(const char *payload, uint16_t payload_len);
+
+#endif
+
+/**
+ * @}
+ */
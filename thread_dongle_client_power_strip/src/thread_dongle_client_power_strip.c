@@ -13,25 +13,42 @@
 #include <zephyr/device.h>
 #include <zephyr/pm/device.h>
 #include <zephyr/sys/printk.h>
+#include <string.h>
 #include <thread_dongle_interface.h>
+#include <relays_mask.h>
 
 #include "coap_client_utils.h"
+#include "periodic_scheduler.h"
+#include "relay_schedule.h"
 
 // Buttons pressed check period
 #define KEEP_ALIVE_MSG_PERIOD_MS   10000
-#define REQUEST_STATUS_PERIOD_MS   2000
 
-// Setup for L1 and L2
-static const struct gpio_dt_spec relay_1 = GPIO_DT_SPEC_GET(DT_ALIAS(relay1), gpios);
-static const struct gpio_dt_spec relay_2 = GPIO_DT_SPEC_GET(DT_ALIAS(relay2), gpios);
-static const struct gpio_dt_spec relay_3 = GPIO_DT_SPEC_GET(DT_ALIAS(relay3), gpios);
-static const struct gpio_dt_spec relay_4 = GPIO_DT_SPEC_GET(DT_ALIAS(relay4), gpios);
+static struct periodic_task status_polling_task;
+static struct periodic_task keep_alive_task;
 
+// Downlink requests queued by the OpenThread thread and applied by downlink_work
+#define DOWNLINK_QUEUE_SIZE 4
 
-bool relay1_status = false;
-bool relay2_status = false;
-bool relay3_status = false;
-bool relay4_status = false;
+struct downlink_request {
+    uint16_t payload_len;
+    char payload[DOWNLINK_PAYLOAD_MAX_SIZE + 1];
+};
+
+K_MSGQ_DEFINE(downlink_msgq, sizeof(struct downlink_request), DOWNLINK_QUEUE_SIZE, 4);
+static struct k_work downlink_work;
+
+// Setup for R1, R2, R3 and R4
+static const struct gpio_dt_spec relays[] = {
+    GPIO_DT_SPEC_GET(DT_ALIAS(relay1), gpios),
+    GPIO_DT_SPEC_GET(DT_ALIAS(relay2), gpios),
+    GPIO_DT_SPEC_GET(DT_ALIAS(relay3), gpios),
+    GPIO_DT_SPEC_GET(DT_ALIAS(relay4), gpios),
+};
+
+// Relays status applied to the pins, bit n set for relay n+1 on
+static uint8_t relays_mask;
+static bool relays_mask_applied = false;
 
 static void on_ot_connect(struct k_work *item)
 {
@@ -45,119 +62,219 @@ static void on_ot_disconnect(struct k_work *item)
     dk_set_led_off(OT_CONNECTION_LED);
 }
 
+static uint8_t relays_mask_get(bool r1_status, bool r2_status, bool r3_status, bool r4_status)
+{
+    return (r1_status ? BIT(0) : 0) | (r2_status ? BIT(1) : 0) | (r3_status ? BIT(2) : 0) | (r4_status ? BIT(3) : 0);
+}
+
+static void relays_apply(uint8_t mask)
+{
+    /*Set relays status, only if it changed*/
+    if (relays_mask_applied && (mask == relays_mask)) {
+        return;
+    }
+
+    // One masked write per GPIO port, so that the relays of a port switch at the same instant
+    for (int i = 0; i < ARRAY_SIZE(relays); i++) {
+        gpio_port_pins_t pins = 0;
+        gpio_port_value_t values = 0;
+        bool port_done = false;
+
+        for (int j = 0; j < i; j++) {
+            port_done = port_done || (relays[j].port == relays[i].port);
+        }
+        if (port_done) {
+            continue;
+        }
+
+        for (int j = i; j < ARRAY_SIZE(relays); j++) {
+            if (relays[j].port == relays[i].port) {
+                pins |= BIT(relays[j].pin);
+                values |= (mask & BIT(j)) ? BIT(relays[j].pin) : 0;
+            }
+        }
+        if (gpio_port_set_masked(relays[i].port, pins, values) < 0) {
+            printk("GPIO [ERROR]: Cannot set relays status\r\n");
+            relays_mask_applied = false;
+            return;
+        }
+    }
+
+    relays_mask = mask;
+    relays_mask_applied = true;
+    printk("THREAD [DEBBUG]: Setting relays statuses  R1:%d  R2:%d  R3:%d  R4:%d \r\n",
+           (mask & BIT(0)) != 0, (mask & BIT(1)) != 0, (mask & BIT(2)) != 0, (mask & BIT(3)) != 0);
+}
+
 static void set_relays_status(bool r1_status, bool r2_status, bool r3_status, bool r4_status){
-    /*Set relays status*/
-
-    gpio_pin_set_dt(&relay_1, r1_status? 1:0);
-    relay1_status = r1_status;
-    gpio_pin_set_dt(&relay_2, r2_status? 1:0);
-    relay2_status = r2_status;
-    gpio_pin_set_dt(&relay_3, r3_status? 1:0);
-    relay3_status = r3_status;
-    gpio_pin_set_dt(&relay_4, r4_status? 1:0);
-    relay4_status = r4_status;
-    printk("THREAD [DEBBUG]: Setting relays statuses  R1:%d  R2:%d  R3:%d  R4:%d \r\n",relay1_status, relay2_status, relay3_status, relay4_status);
+    relays_apply(relays_mask_get(r1_status, r2_status, r3_status, r4_status));
 }
 
 static void set_single_relay_status(uint16_t relay_number, bool status){
     /*Set single relays status*/
 
-    if(relay_number == 1){
-        gpio_pin_set_dt(&relay_1, status? 1:0);
-        relay1_status = status;
-        return;
-    }   
-    if(relay_number == 2){
-        gpio_pin_set_dt(&relay_2, status? 1:0);
-        relay2_status = status;
-        return;
-    }   
-    if(relay_number == 3){
-        gpio_pin_set_dt(&relay_3, status? 1:0);
-        relay3_status = status;
+    if ((relay_number < 1) || (relay_number > ARRAY_SIZE(relays))) {
+        printk("ERROR invalid relay number: %d", relay_number);
         return;
-    }   
-    if(relay_number == 4){
-        gpio_pin_set_dt(&relay_4, status? 1:0);
-        relay4_status = status;
-        return;
-    }    
-    printk("ERROR invalid relay number: %d", relay_number);
-    return;
+    }
+    relays_apply(status ? (relays_mask | BIT(relay_number - 1)) : (relays_mask & ~BIT(relay_number - 1)));
 }
 
 static void update_power_strip_status(){
 
-    bool r1_status = get_server_r1_status();
-    bool r2_status = get_server_r2_status();
-    bool r3_status = get_server_r3_status();
-    bool r4_status = get_server_r4_status();
+    set_relays_status(get_server_r1_status(), get_server_r2_status(), get_server_r3_status(), get_server_r4_status());
+}
 
-    printk("THREAD [DEBBUG] Current power strip status R1:%d  R2:%d  R3:%d  R4:%d\r\n", r1_status, r2_status, r3_status, r4_status);
 
-    set_relays_status(r1_status, r2_status, r3_status, r4_status);
+static void relays_mask_update(uint8_t mask, uint8_t values)
+{
+    // The relays out of the mask keep their last known server status
+    set_server_relays_status((mask & BIT(0)) ? (values & BIT(0)) != 0 : get_server_r1_status(),
+                             (mask & BIT(1)) ? (values & BIT(1)) != 0 : get_server_r2_status(),
+                             (mask & BIT(2)) ? (values & BIT(2)) != 0 : get_server_r3_status(),
+                             (mask & BIT(3)) ? (values & BIT(3)) != 0 : get_server_r4_status());
+    update_power_strip_status();
 }
 
+/* Parse a full relays status: outlet:XXXX, returns false if the payload is not one */
+static bool relays_outlet_parse(const char *payload, uint8_t *values)
+{
+    const char *outlet_in_payload = strstr(payload, OUTLET_PAYLOAD_PREFIX);
 
-int main(void)
+    if ((outlet_in_payload == NULL) || (strlen(outlet_in_payload) < strlen(OUTLET_PAYLOAD_PREFIX) + 4)) {
+        return false;
+    }
+
+    const char *relays = outlet_in_payload + strlen(OUTLET_PAYLOAD_PREFIX);
+    *values = relays_mask_get(relays[0] == '1', relays[1] == '1', relays[2] == '1', relays[3] == '1');
+    return true;
+}
+
+/* Switch the relays due in the schedule, and report them to the server so that its status follows.
+ * Reported first: the relays stay pending, a poll reply does not revert them until the server acknowledged them.
+ */
+static void on_schedule_due(uint8_t mask, uint8_t values)
 {
-    int ret1;
-    int ret2;
-    int ret3;
-    int ret4;
-    
-    //Check if R1, R2, R3 and R4 are ready
-    if ((!device_is_ready(relay_1.port)) && (!device_is_ready(relay_2.port)) && (!device_is_ready(relay_3.port)) && (!device_is_ready(relay_4.port))){
-        printk("GPIO [ERROR]: Cannot configure devices\r\n");
-        return 0;
+    coap_client_send_relays_update(mask, values);
+    relays_mask_update(mask, values);
+}
+
+/* Apply the relays status sent by the server: outlet:XXXX or mask:MV, or a new schedule: sched:...
+ * Runs in the system workqueue like the poll replies and the schedule, never in the OpenThread thread.
+ */
+static void downlink_apply(const char *payload, uint16_t payload_len)
+{
+    uint8_t mask;
+    uint8_t values;
+
+    if (strncmp(payload, SCHEDULE_PAYLOAD_PREFIX, strlen(SCHEDULE_PAYLOAD_PREFIX)) == 0) {
+        int ret = relay_schedule_set(payload, payload_len);
+        if (ret) {
+            printk("THREAD [ERROR]: Invalid schedule (error: %d)\r\n", ret);
+        }
+        return;
     }
 
-    //Configure R1, R2, R3 and R4 as outputs
-    ret1 = gpio_pin_configure_dt(&relay_1, GPIO_OUTPUT_ACTIVE);
-    ret2 = gpio_pin_configure_dt(&relay_2, GPIO_OUTPUT_ACTIVE);
-    ret3 = gpio_pin_configure_dt(&relay_3, GPIO_OUTPUT_ACTIVE);
-    ret4 = gpio_pin_configure_dt(&relay_4, GPIO_OUTPUT_ACTIVE);
-    if ((ret1 < 0) && (ret2 < 0) && (ret3 < 0) && (ret4 < 0)) {
-        printk("GPIO [ERROR]: Cannot configure pins\r\n");
-        return 0;
+    // mask:MV, or outlet:XXXX for all the relays
+    if (relays_mask_payload_parse(payload, payload_len, &mask, &values)) {
+        if (!relays_outlet_parse(payload, &values)) {
+            printk("THREAD [ERROR]: Unexpected downlink request\r\n");
+            return;
+        }
+        mask = BIT_MASK(ARRAY_SIZE(relays));
+    }
+
+    // The downlink did not go through the server status, update it or the next poll reverts the relays
+    coap_client_send_relays_update(mask, values);
+    relays_mask_update(mask, values);
+}
+
+static void downlink_handler(struct k_work *item)
+{
+    struct downlink_request request;
+
+    ARG_UNUSED(item);
+
+    while (k_msgq_get(&downlink_msgq, &request, K_NO_WAIT) == 0) {
+        downlink_apply(request.payload, request.payload_len);
     }
+}
 
-    ret1 = dk_leds_init();
-    if (ret1) {
-        printk("LEDS [ERROR]: Cannot init leds, (error: %d)\r\n", ret1);
+/* Called in the OpenThread thread: only queue the payload */
+static void on_downlink_request(const uint8_t *payload, uint16_t payload_len)
+{
+    struct downlink_request request;
+
+    request.payload_len = MIN(payload_len, DOWNLINK_PAYLOAD_MAX_SIZE);
+    memcpy(request.payload, payload, request.payload_len);
+    request.payload[request.payload_len] = '\0';
+
+    if (k_msgq_put(&downlink_msgq, &request, K_NO_WAIT) != 0) {
+        printk("THREAD [ERROR]: Downlink request dropped, queue full\r\n");
+        return;
+    }
+    k_work_submit(&downlink_work);
+}
+
+static void on_power_strip_status_reply(int result, bool changed)
+{
+    if (result != 0) {
+        // Keep the relays as they are, the next poll will refresh them
+        printk("GPIO [DEBBUG]: Power strip status not refreshed, relays unchanged\r\n");
+        return;
+    }
+    periodic_task_changed(&status_polling_task, changed);
+    update_power_strip_status();
+}
+
+int main(void)
+{
+    int ret;
+    
+    //Check if R1, R2, R3 and R4 are ready, and configure them as outputs
+    for (int i = 0; i < ARRAY_SIZE(relays); i++) {
+        if (!device_is_ready(relays[i].port)) {
+            printk("GPIO [ERROR]: Cannot configure devices\r\n");
+            return 0;
+        }
+        ret = gpio_pin_configure_dt(&relays[i], GPIO_OUTPUT_ACTIVE);
+        if (ret < 0) {
+            printk("GPIO [ERROR]: Cannot configure pins\r\n");
+            return 0;
+        }
+    }
+
+    ret = dk_leds_init();
+    if (ret) {
+        printk("LEDS [ERROR]: Cannot init leds, (error: %d)\r\n", ret);
         return 0;
     }    
 
     //Set R1(on), R2(on), R3(on) and R4(on) initial values
-    gpio_pin_set_dt(&relay_1, 1);
-    gpio_pin_set_dt(&relay_2, 1);
-    gpio_pin_set_dt(&relay_3, 1);
-    gpio_pin_set_dt(&relay_4, 1);
-    relay1_status = true;
-    relay2_status = true;
-    relay3_status = true;
-    relay4_status = true;
+    set_relays_status(true, true, true, true);
+
+    // Relays switched locally once a schedule is received
+    relay_schedule_init(on_schedule_due);
+    k_work_init(&downlink_work, downlink_handler);
 
     // Init thread/coap
     coap_client_utils_init(on_ot_connect, on_ot_disconnect);   
 
-    int wait_loops_for_ka = KEEP_ALIVE_MSG_PERIOD_MS / REQUEST_STATUS_PERIOD_MS;
-    int loops_count = 0;
+    if (coap_client_downlink_init(on_downlink_request)) {
+        printk("THREAD [ERROR]: Cannot init downlink resource\r\n");
+    }
+
+    if (coap_client_caching_proxy_init()) {
+        printk("THREAD [ERROR]: Cannot init caching proxy\r\n");
+    }
 
-    // Set initial relays status
-    set_relays_status(true,true,true,true);
     k_msleep(1000);
 
-    while (1) {
-        coap_client_send_power_strip_status_request();
-        k_msleep(REQUEST_STATUS_PERIOD_MS*0.3);
-        update_power_strip_status();
-        k_msleep(REQUEST_STATUS_PERIOD_MS*0.7);
-        if (loops_count >=wait_loops_for_ka ){
-            coap_client_send_keep_alive();   
-            loops_count = 0;
-        } 
-        loops_count ++;
-    }
+    // Periodic requests with an offset and a jitter specific to this node
+    coap_client_status_reply_cb_set(on_power_strip_status_reply);
+    periodic_scheduler_init(coap_client_device_hash());
+    periodic_task_adaptive_start(&status_polling_task, CONFIG_CLIENT_POLLING_MIN_PERIOD_MS, CONFIG_CLIENT_POLLING_MAX_PERIOD_MS,
+                                 coap_client_send_power_strip_status_request);
+    periodic_task_start(&keep_alive_task, KEEP_ALIVE_MSG_PERIOD_MS, coap_client_send_keep_alive);
     return 0;
 }
\ No newline at end of file
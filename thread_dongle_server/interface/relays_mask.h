@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __RELAYS_MASK_H__
+#define __RELAYS_MASK_H__
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <thread_dongle_interface.h>
+
+/**@brief Value of one hex digit, -1 if the character is not one.
+ */
+static inline int hex_digit_get(char digit)
+{
+    if ((digit >= '0') && (digit <= '9')) {
+        return digit - '0';
+    }
+    if ((digit >= 'a') && (digit <= 'f')) {
+        return digit - 'a' + 10;
+    }
+    if ((digit >= 'A') && (digit <= 'F')) {
+        return digit - 'A' + 10;
+    }
+    return -1;
+}
+
+/**@brief Parse a relays masked update payload: mask:MV
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if the payload is malformed.
+ */
+static inline int relays_mask_payload_parse(const char *payload, uint16_t payload_len, uint8_t *mask,
+                                            uint8_t *values)
+{
+    uint16_t prefix_len = strlen(RELAYS_MASK_PAYLOAD_PREFIX);
+
+    if ((payload_len != prefix_len + 2) || (strncmp(payload, RELAYS_MASK_PAYLOAD_PREFIX, prefix_len) != 0)) {
+        return -EINVAL;
+    }
+
+    int mask_digit = hex_digit_get(payload[prefix_len]);
+    int values_digit = hex_digit_get(payload[prefix_len + 1]);
+    if ((mask_digit < 0) || (values_digit < 0)) {
+        return -EINVAL;
+    }
+
+    *mask = mask_digit;
+    *values = values_digit;
+    return 0;
+}
+
+#endif
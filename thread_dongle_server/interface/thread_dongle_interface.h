@@ -18,6 +18,9 @@
 #define PRESENCE_URI_PATH "presence"
 #define ELECTRIC_URI_PATH "energy"
 #define POWER_STRIP_URI_PATH "power_strip"
+#define DOWNLINK_URI_PATH "downlink"
+#define REPLICATION_URI_PATH "replication"
+#define NOTIFY_URI_PATH "notify"
 
 #define ALARM "al_bt_em"
 #define CMD1 "cmd_1"
@@ -28,6 +31,97 @@
 #define KEEP_ALIVE_DEVICE_ID_5 "ka_5"
 #define KEEP_ALIVE_DEVICE_ID_6 "ka_6"
 #define KEEP_ALIVE_DEVICE_ID_7 "ka_7"
+#define KEEP_ALIVE_PREFIX "ka_"
+#define CLIENT_DEVICES_MAX 16
+
+/* Separator between the records of a multi-record UART frame: ~cmd;cmd;...#
+ * and between the commands batched by a client in a single commands request
+ */
+#define COMMANDS_RECORD_SEPARATOR ';'
+
+/* Commands responses */
+#define COMMANDS_OK "CMD:OK"
+#define COMMANDS_TIMEOUT "CMD:TIMEOUT"
+#define COMMANDS_ERROR "CMD:ERROR"
+#define COMMANDS_LATENCY "lat:"
+
+/* Frame sent by the gateway to acknowledge a commands UART frame: ~ack# */
+#define GATEWAY_ACK "ack"
+
+/* Frame sent by the gateway to set the server commands coalescing window: ~win <ms>#, 0 disables it */
+#define COALESCING_WINDOW_FRAME "win"
+
+/* Frame sent by the gateway to forward a request to a client: ~dl <target> <payload>#
+ * target is r<rloc16 in hex>, e<mesh-local EID>, d<device id> (learnt from keep alive msgs)
+ * or g<multicast group id in hex>
+ */
+#define DOWNLINK_FRAME "dl"
+#define DOWNLINK_TARGET_RLOC16 'r'
+#define DOWNLINK_TARGET_ML_EID 'e'
+#define DOWNLINK_TARGET_DEVICE_ID 'd'
+#define DOWNLINK_TARGET_GROUP 'g'
+/* Sized for a relays schedule of 9 entries: sched:HHMMSS then 9 x ;HHMMSSMV */
+#define DOWNLINK_PAYLOAD_MAX_SIZE 96
+
+/* Application multicast groups: ff03::4748:<group id> */
+#define GROUP_MULTICAST_ADDR(group_id) { 0xff, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, \
+                                         0x00, 0x00, 0x00, 0x00, 0x47, 0x48, \
+                                         ((group_id) >> 8) & 0xff, (group_id) & 0xff }
+
+/* Room groups use ids 0x0001 to 0x00ff, device class groups: */
+#define GROUP_ID_ALL_CLIENTS   0x0100
+#define GROUP_ID_POWER_STRIPS  0x0101
+#define GROUP_ID_BADGES        0x0102
+#define GROUP_ID_CAMERAS       0x0103
+#define GROUP_ID_BUTTONS       0x0104
+/* Group joined by the server nodes, addressed by the clients requests: GROUP_ID_SERVERS + shard index */
+#define GROUP_ID_SERVERS       0x0200
+/* Group joined by the server nodes of a shard to replicate their state: GROUP_ID_SERVER_REPLICAS + shard index */
+#define GROUP_ID_SERVER_REPLICAS 0x0210
+/* Group notified of the status changes of a shard, joined by the clients of the shard:
+ * GROUP_ID_STATUS_SUBSCRIBERS + shard index, payload v:<state version of the shard server>
+ */
+#define GROUP_ID_STATUS_SUBSCRIBERS 0x0220
+#define NOTIFY_VERSION_PREFIX "v:"
+
+/* Thread Network Data service advertised by the server nodes */
+#define SERVICE_ENTERPRISE_NUMBER 44970
+#define SERVICE_NAME "_greenhome._udp"
+/* Service advertised by the routers caching the status responses for their children */
+#define PROXY_SERVICE_NAME "_greenhome-proxy._udp"
+/* Service server data: CoAP port (2 bytes), shard index, shard count, server epoch
+ * The epoch is incremented each time a standby server takes over, clients use the newest one.
+ * Epoch 0 is the epoch of a server that never took over and is older than any other, the
+ * following ones wrap from 255 to 1 and compare in serial number arithmetic.
+ * Between two servers of the same epoch the one with the lowest RLOC16 wins.
+ */
+#define SERVICE_SERVER_DATA_SIZE 5
+#define SERVER_EPOCH_NEXT(epoch) (((epoch) == 0xff) ? 1 : ((epoch) + 1))
+#define SERVER_EPOCH_NEWER(epoch, than) (((than) == 0) ? ((epoch) != 0) : \
+                                         (((epoch) != 0) && ((int8_t)((epoch) - (than)) > 0)))
+
+/* Failover reports forwarded to the gateway as commands records:
+ * fo_<ms> by a standby server taking over, <ms> since the last heartbeat of the active server
+ * lost_<count>_<ms> by a client answered again, requests timed out during <ms> without answer
+ */
+#define FAILOVER_REPORT_PREFIX "fo_"
+#define LOST_REQUESTS_REPORT_PREFIX "lost_"
+
+/* Power strip relays status payload: outlet:XXXX */
+#define OUTLET_PAYLOAD_PREFIX "outlet:"
+#define POWER_STRIP_RELAYS_COUNT 4
+/* Single relay status payload, at POWER_STRIP_URI_PATH/<relay number from 1>: relay:X */
+#define RELAY_PAYLOAD_PREFIX "relay:"
+/* Relays masked update payload: mask:MV, M and V one hex digit each, bit n for relay n+1.
+ * The relays set in M take their bit in V, the others are kept. Sent in a PUT to
+ * POWER_STRIP_URI_PATH, as a downlink payload to the power strips and by the gateway: ~mask:MV#
+ */
+#define RELAYS_MASK_PAYLOAD_PREFIX "mask:"
+/* Power strip schedule downlink payload: sched:HHMMSS;HHMMSSMV;...
+ * HHMMSS is the current time of the day, then each record switches the relays of mask M
+ * to their bit in V at time HHMMSS, every day. Replaces the whole schedule.
+ */
+#define SCHEDULE_PAYLOAD_PREFIX "sched:"
 
 
 /*LEDS configuration*/
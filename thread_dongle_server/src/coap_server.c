@@ -12,6 +12,8 @@
 #include <openthread/thread.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/drivers/uart.h>
+#include <string.h>
+#include <stdlib.h>
 
 #include "ot_coap_utils.h"
 
@@ -22,19 +24,253 @@
 #define UART_RECEIVE_TIMEOUT 500000
 #define START_CHAR '~'
 #define END_CHAR '#'
+#define UART_TX_TIMEOUT_MS 100
+
+// Commands coalescing variables
+#define COMMANDS_BATCH_BUFF_SIZE 256
+
+// Longest downlink frame: dl e<mesh-local EID> <payload>
+#define UART_FRAME_MAX_SIZE (sizeof(DOWNLINK_FRAME) + 41 + DOWNLINK_PAYLOAD_MAX_SIZE + 1)
 
 const struct device *uart= DEVICE_DT_GET(DT_NODELABEL(uart0));
 static uint8_t rx_buf[MSG_BUFF_SIZE] = {0};
-static uint8_t rx_msg_buf[MSG_MAX_SIZE] = {0};
+static uint8_t rx_msg_buf[UART_FRAME_MAX_SIZE] = {0};
 static uint8_t rx_offset=0;
 
+// Downlink frames received from the gateway, handled out of the UART callback
+struct downlink_frame {
+    uint8_t buf[UART_FRAME_MAX_SIZE];
+};
+
+K_MSGQ_DEFINE(downlink_msgq, sizeof(struct downlink_frame), 4, 4);
+static struct k_work downlink_work;
+
+// Buffer owned by the UART driver until UART_TX_DONE
+static uint8_t tx_frame_buf[COMMANDS_BATCH_BUFF_SIZE + 2];
+static K_SEM_DEFINE(uart_tx_sem, 1, 1);
+
+// Commands waiting in the coalescing window
+struct commands_batch {
+    uint8_t buf[COMMANDS_BATCH_BUFF_SIZE];
+    uint16_t len;
+    uint8_t records;
+    int64_t received_time[CONFIG_COMMANDS_COALESCING_MAX_RECORDS];
+};
+
+// Forwarding statistics: frames/s and per-command latency, from the reception of the command by the
+// server to its frame handed to the UART driver. Reset on each coalescing window change.
+struct commands_batch_stats {
+    int64_t start_time;
+    uint32_t frames;
+    uint32_t commands;
+    int64_t latency_sum_ms;
+    int64_t latency_max_ms;
+};
+
+static struct commands_batch cmd_batch;
+static struct commands_batch_stats cmd_batch_stats;
+static K_MUTEX_DEFINE(cmd_batch_mutex);
+static struct k_work_delayable cmd_batch_flush_work;
+// Coalescing window, CONFIG_COMMANDS_COALESCING_WINDOW_MS until the gateway sets another one
+static uint32_t cmd_batch_window_ms = CONFIG_COMMANDS_COALESCING_WINDOW_MS;
+static atomic_t cmd_batch_window_request;
+static struct k_work cmd_batch_window_work;
+
+// Commands LED switched off without blocking the forwarding of the commands
+static struct k_work_delayable commands_led_work;
+
+/* Send a frame over UART once the previous transmission is done */
+static int uart_send_frame(const uint8_t *frame, uint16_t frame_len)
+{
+    if (frame_len > sizeof(tx_frame_buf)) {
+        printk("UART [ERROR]: Frame too long (%d bytes)\r\n", frame_len);
+        return -EMSGSIZE;
+    }
+
+    if (k_sem_take(&uart_tx_sem, K_MSEC(UART_TX_TIMEOUT_MS))) {
+        printk("UART [ERROR]: Previous transmission not finished\r\n");
+        return -EBUSY;
+    }
+
+    memcpy(tx_frame_buf, frame, frame_len);
+    int ret = uart_tx(uart, tx_frame_buf, frame_len, SYS_FOREVER_MS);
+    if (ret) {
+        k_sem_give(&uart_tx_sem);
+    }
+    return ret;
+}
+
+/* Account a frame handed to the UART driver, with the reception time of each of its commands */
+static void commands_stats_update(const int64_t *received_time, uint8_t records)
+{
+    int64_t now = k_uptime_get();
+
+    for (int i = 0; i < records; i++) {
+        int64_t latency = now - received_time[i];
+        cmd_batch_stats.latency_sum_ms += latency;
+        if (latency > cmd_batch_stats.latency_max_ms) {
+            cmd_batch_stats.latency_max_ms = latency;
+        }
+    }
+    cmd_batch_stats.frames ++;
+    cmd_batch_stats.commands += records;
+}
+
+/* Send commands records to the gateway as a ~cmd;cmd;...# frame, a single command being ~cmd#.
+ * Only called from the system workqueue.
+ */
+static int commands_frame_send(const uint8_t *records, uint16_t len)
+{
+    static uint8_t frame[COMMANDS_BATCH_BUFF_SIZE + 2];
+    uint16_t frame_len = 0;
+
+    len = MIN(len, COMMANDS_BATCH_BUFF_SIZE);
+    frame[frame_len++] = START_CHAR;
+    memcpy(&frame[frame_len], records, len);
+    frame_len += len;
+    frame[frame_len++] = END_CHAR;
+
+    return uart_send_frame(frame, frame_len);
+}
+
+/* Send the coalesced commands as a single frame, must be called with cmd_batch_mutex held */
+static void commands_batch_send(void)
+{
+    if (cmd_batch.records == 0) {
+        return;
+    }
+
+    printk("UART [DEBBUG]: Sending %d coalesced commands via UART\r\n", cmd_batch.records);
+    uint8_t records = cmd_batch.records;
+    int ret = commands_frame_send(cmd_batch.buf, cmd_batch.len);
+    cmd_batch.len = 0;
+    cmd_batch.records = 0;
+
+    if (ret) {
+        printk("UART [ERROR]: Impossible to send message over UART\r\n");
+        commands_uart_frame_failed(records);
+        return;
+    }
+    commands_stats_update(cmd_batch.received_time, records);
+    commands_uart_frame_sent(records);
+}
+
+/* Coalescing window elapsed */
+static void commands_batch_flush(struct k_work *item)
+{
+    ARG_UNUSED(item);
+
+    k_mutex_lock(&cmd_batch_mutex, K_FOREVER);
+    commands_batch_send();
+    k_mutex_unlock(&cmd_batch_mutex);
+}
+
+/* Add a command to the coalescing window */
+static void commands_batch_add(const uint8_t *cmd, uint8_t cmd_len, int64_t received_time)
+{
+    // Commands sent by the clients can be NULL terminated
+    uint16_t record_len = strnlen((const char *)cmd, cmd_len);
+    bool is_alarm = strncmp((const char *)cmd, ALARM, strlen(ALARM)) == 0;
+
+    if (record_len == 0) {
+        return;
+    }
+
+    k_mutex_lock(&cmd_batch_mutex, K_FOREVER);
+
+    // Flush early if the record does not fit in the current frame
+    if (cmd_batch.len + record_len + 1 > sizeof(cmd_batch.buf)) {
+        commands_batch_send();
+    }
+    if (record_len > sizeof(cmd_batch.buf)) {
+        record_len = sizeof(cmd_batch.buf);
+    }
+
+    if (cmd_batch.records > 0) {
+        cmd_batch.buf[cmd_batch.len++] = COMMANDS_RECORD_SEPARATOR;
+    }
+    memcpy(&cmd_batch.buf[cmd_batch.len], cmd, record_len);
+    cmd_batch.len += record_len;
+    cmd_batch.received_time[cmd_batch.records] = received_time;
+    cmd_batch.records ++;
+
+    if (is_alarm || cmd_batch.records >= CONFIG_COMMANDS_COALESCING_MAX_RECORDS) {
+        // Window full or alarm received: flush now
+        commands_batch_send();
+        k_work_cancel_delayable(&cmd_batch_flush_work);
+    } else if (cmd_batch.records == 1) {
+        // First command opens the window
+        k_work_schedule(&cmd_batch_flush_work, K_MSEC(cmd_batch_window_ms));
+    }
+
+    k_mutex_unlock(&cmd_batch_mutex);
+}
+
+/* Print forwarding statistics since the last window change */
+static void print_commands_batch_stats(void)
+{
+    int64_t elapsed_ms = k_uptime_get() - cmd_batch_stats.start_time;
+    // Hundredths of frames per second
+    uint32_t frames_per_s = elapsed_ms > 0 ? (uint32_t)((cmd_batch_stats.frames * 100000LL) / elapsed_ms) : 0;
+    uint32_t mean_latency_ms = cmd_batch_stats.commands > 0 ? (uint32_t)(cmd_batch_stats.latency_sum_ms / cmd_batch_stats.commands) : 0;
+
+    printk("UART [DEBBUG]: window:%dms  time:%dms  frames:%d  commands:%d  frames/s:%d.%02d  latency mean:%dms max:%dms\r\n",
+        cmd_batch_window_ms, (uint32_t)elapsed_ms, cmd_batch_stats.frames, cmd_batch_stats.commands,
+        frames_per_s / 100, frames_per_s % 100, mean_latency_ms, (uint32_t)cmd_batch_stats.latency_max_ms);
+}
+
+/* Coalescing window set by the gateway: ~win <ms>#
+ * The statistics of the previous window are printed and reset, so that several window sizes can be
+ * compared on the same traffic.
+ */
+static void commands_batch_window_set(struct k_work *item)
+{
+    ARG_UNUSED(item);
+
+    k_mutex_lock(&cmd_batch_mutex, K_FOREVER);
+    commands_batch_send();
+    k_work_cancel_delayable(&cmd_batch_flush_work);
+
+    print_commands_batch_stats();
+    memset(&cmd_batch_stats, 0, sizeof(cmd_batch_stats));
+    cmd_batch_stats.start_time = k_uptime_get();
+    cmd_batch_window_ms = atomic_get(&cmd_batch_window_request);
+    k_mutex_unlock(&cmd_batch_mutex);
+
+    printk("UART [DEBBUG]: Commands coalescing window set to %dms\r\n", cmd_batch_window_ms);
+}
+
+/* Send the downlink requests received from the gateway: dl <target> <payload> */
+static void downlink_frames_process(struct k_work *item)
+{
+    struct downlink_frame frame;
+
+    ARG_UNUSED(item);
+
+    while (k_msgq_get(&downlink_msgq, &frame, K_NO_WAIT) == 0) {
+        char *target = (char *)&frame.buf[strlen(DOWNLINK_FRAME) + 1];
+        char *payload = strchr(target, ' ');
+
+        if (payload == NULL) {
+            printk("UART [ERROR]: Downlink frame without payload\r\n");
+            continue;
+        }
+        *payload = '\0';
+        payload ++;
+
+        uint16_t payload_len = MIN(strlen(payload), DOWNLINK_PAYLOAD_MAX_SIZE);
+        if (ot_coap_send_downlink(target, payload, payload_len)) {
+            printk("UART [ERROR]: Impossible to send downlink request to %s\r\n", target);
+        }
+    }
+}
 
 /* Process received char from UART */
 static void process_received_char(char received_char)
 {
 	if(received_char == START_CHAR){
 		// Empty msg buffer
-		for( int i =0; i < MSG_MAX_SIZE; i++ ){
+		for( int i =0; i < UART_FRAME_MAX_SIZE; i++ ){
 			rx_msg_buf[i] = NULL;
         }
 		rx_offset = 0;
@@ -47,6 +283,45 @@ static void process_received_char(char received_char)
         }
 		printk("\r\n");
 
+        // Check if gateway acknowledgment received
+        if ((rx_offset == strlen(GATEWAY_ACK)) && (strncmp(rx_msg_buf, GATEWAY_ACK, rx_offset) == 0)) {
+            commands_gateway_ack_received();
+            return;
+        }
+
+        // Check if coalescing window change received: win <ms>
+        if ((rx_offset > strlen(COALESCING_WINDOW_FRAME)) &&
+            (strncmp(rx_msg_buf, COALESCING_WINDOW_FRAME, strlen(COALESCING_WINDOW_FRAME)) == 0) &&
+            (rx_msg_buf[strlen(COALESCING_WINDOW_FRAME)] == ' ')) {
+            atomic_set(&cmd_batch_window_request, strtoul(&rx_msg_buf[strlen(COALESCING_WINDOW_FRAME) + 1], NULL, 10));
+            k_work_submit(&cmd_batch_window_work);
+            return;
+        }
+
+        // Check if downlink request received
+        if ((rx_offset > strlen(DOWNLINK_FRAME)) && (strncmp(rx_msg_buf, DOWNLINK_FRAME, strlen(DOWNLINK_FRAME)) == 0) &&
+            (rx_msg_buf[strlen(DOWNLINK_FRAME)] == ' ')) {
+            if (k_msgq_put(&downlink_msgq, rx_msg_buf, K_NO_WAIT)) {
+                printk("UART [ERROR]: Downlink queue full, frame dropped\r\n");
+                return;
+            }
+            k_work_submit(&downlink_work);
+            return;
+        }
+
+        // Check if relays masked update received: mask:MV
+        if (strncmp(rx_msg_buf, RELAYS_MASK_PAYLOAD_PREFIX, strlen(RELAYS_MASK_PAYLOAD_PREFIX)) == 0) {
+            uint8_t mask;
+            uint8_t values;
+
+            if (relays_mask_payload_parse(rx_msg_buf, rx_offset, &mask, &values)) {
+                printk("UART [ERROR]: Unexpected relays masked update\r\n");
+                return;
+            }
+            set_power_strip_relays(mask, values);
+            return;
+        }
+
         // Check if wifi in message received
         char* wifi_in_msg = strchr(rx_msg_buf, 'w');
         if(*wifi_in_msg != NULL){
@@ -89,6 +364,10 @@ static void process_received_char(char received_char)
 		return;
 	}
 	else{
+		// Keep the last char for the string terminator
+		if(rx_offset >= UART_FRAME_MAX_SIZE - 1){
+			return;
+		}
 		rx_msg_buf[rx_offset]=received_char;
 		rx_offset ++;
 		return;
@@ -108,13 +387,24 @@ static void on_uart_message(const struct device *uart_dev, struct uart_event *ev
 	case UART_RX_DISABLED:
 		uart_rx_enable(uart_dev, rx_buf, sizeof(rx_buf), UART_RECEIVE_TIMEOUT);
 		break;
+	case UART_TX_DONE:
+	case UART_TX_ABORTED:
+		k_sem_give(&uart_tx_sem);
+		break;
 	default:
 		break;
 	}
 }
 
-// Callback for commands topic
-static void on_commands_request(uint8_t* msg_buf, uint8_t msg_len)
+static void commands_led_off(struct k_work *item)
+{
+    ARG_UNUSED(item);
+
+    dk_set_led_off(COMMANDS_MSG_LED);
+}
+
+// Callback for commands topic, called from the system workqueue for each record
+static void on_commands_request(uint8_t* msg_buf, uint8_t msg_len, int64_t received_time)
 {
 
     printk("THREAD [DEBBUG]: Commands msg received: ");
@@ -123,15 +413,25 @@ static void on_commands_request(uint8_t* msg_buf, uint8_t msg_len)
     }
     printk("\r\n");
     dk_set_led_on(COMMANDS_MSG_LED);
-    k_msleep(LED_ON_TIME_MS);
-    dk_set_led_off(COMMANDS_MSG_LED);    
+    k_work_reschedule(&commands_led_work, K_MSEC(LED_ON_TIME_MS));
 
-    int ret = uart_tx(uart, msg_buf, msg_len, SYS_FOREVER_MS);
+    // The window only changes in the system workqueue, like this callback
+    if (cmd_batch_window_ms > 0) {
+        commands_batch_add(msg_buf, msg_len, received_time);
+        return;
+    }
+
+    // Same framing as the coalesced commands, without the NULL terminator sent by the clients
+    int ret = commands_frame_send(msg_buf, strnlen((const char *)msg_buf, msg_len));
     printk("UART [DEBBUG]: Sending message via UART\r\n");
+
     if (ret) {
         printk("UART [ERROR]: Impossible to send message over UART\r\n");
-        return 1;
+        commands_uart_frame_failed(1);
+        return;
     }
+    commands_stats_update(&received_time, 1);
+    commands_uart_frame_sent(1);
 }
 
 // Callback for ressources status topic
@@ -185,6 +485,7 @@ static void on_button_changed(uint32_t button_state, uint32_t has_changed)
         // switch_electrical_status();
         //switch_power_strip_status();
         print_ressources_status();
+        print_commands_batch_stats();
     }    
 }
 
@@ -196,6 +497,7 @@ static void on_thread_state_changed(otChangedFlags flags, struct openthread_cont
         case OT_DEVICE_ROLE_CHILD:
         case OT_DEVICE_ROLE_ROUTER:
         case OT_DEVICE_ROLE_LEADER:
+            ot_coap_server_start();
             dk_set_led_on(OT_CONNECTION_LED);
             break;
 
@@ -270,6 +572,15 @@ int main(void)
         return 1;
     } 
 
+    // Init downlink requests processing
+    k_work_init(&downlink_work, downlink_frames_process);
+    k_work_init(&cmd_batch_window_work, commands_batch_window_set);
+
+    // Init commands coalescing
+    k_work_init_delayable(&cmd_batch_flush_work, commands_batch_flush);
+    k_work_init_delayable(&commands_led_work, commands_led_off);
+    cmd_batch_stats.start_time = k_uptime_get();
+
     // Start uart receiving reception in buffer
     uart_rx_enable(uart, rx_buf, sizeof(rx_buf), UART_RECEIVE_TIMEOUT);
 
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
  */
 
+#include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/net/net_pkt.h>
 #include <zephyr/net/net_l2.h>
@@ -11,12 +12,103 @@
 #include <openthread/coap.h>
 #include <openthread/ip6.h>
 #include <openthread/message.h>
+#include <openthread/server.h>
 #include <openthread/thread.h>
+#include <zephyr/sys/byteorder.h>
+#include <stdlib.h>
 #include "ot_coap_utils.h"
 
 uint8_t msg_buf[MSG_BUFF_SIZE];
 uint16_t msg_len = 0; 
 
+#define PENDING_COMMANDS_MAX 8
+#define PENDING_FRAMES_MAX 16
+
+// Records forwarded to the gateway, written to the UART out of the OpenThread callbacks
+#define FORWARD_RECORD_MAX_SIZE 64
+#define FORWARD_QUEUE_SIZE 16
+
+// Replicated state: epoch (1 byte), state version (4 bytes), status bits (1 byte), sender RLOC16 (2 bytes)
+#define REPLICATION_PAYLOAD_SIZE 8
+#define REPLICATION_WIFI_BIT        BIT(0)
+#define REPLICATION_PRESENCE_BIT    BIT(1)
+#define REPLICATION_ELECTRICAL_BIT  BIT(2)
+#define REPLICATION_R1_BIT          BIT(3)
+#define REPLICATION_R2_BIT          BIT(4)
+#define REPLICATION_R3_BIT          BIT(5)
+#define REPLICATION_R4_BIT          BIT(6)
+
+/* Command waiting for the gateway acknowledgment before being answered */
+struct pending_command {
+    bool in_use;
+    uint8_t token[OT_COAP_MAX_TOKEN_LENGTH];
+    uint8_t token_len;
+    otMessageInfo msg_info;
+    int64_t arrival_time;
+    /* Set once the records of the command are numbered, before they can be written to the UART */
+    bool queued;
+    uint32_t first_record;
+    uint32_t last_record;
+    bool failed;
+};
+
+/* Record forwarded to the gateway */
+struct forward_record {
+    uint8_t buf[FORWARD_RECORD_MAX_SIZE + 1];
+    uint8_t len;
+    int64_t received_time;
+};
+
+/* UART frame waiting for the gateway acknowledgment, acknowledged in the order they were written */
+struct pending_frame {
+    uint32_t last_record;
+    int64_t sent_time;
+};
+
+/* Client address learnt from its keep alive messages */
+struct client_device {
+    bool known;
+    otIp6Address addr;
+};
+
+/* Keep alive msgs received from the clients, and forwarded on their behalf */
+static uint32_t explicit_keep_alives;
+static uint32_t implicit_keep_alives;
+/* Devices with requests, and with keep alive msgs, during the current keep alive period: bit n for device id n */
+BUILD_ASSERT(CLIENT_DEVICES_MAX <= 32, "Device ids must fit the activity bitmaps");
+static atomic_t active_devices = ATOMIC_INIT(0);
+static atomic_t keep_alive_devices = ATOMIC_INIT(0);
+static struct k_work_delayable keep_alive_work;
+
+static struct client_device client_devices[CLIENT_DEVICES_MAX];
+
+static struct pending_command pending_commands[PENDING_COMMANDS_MAX];
+static struct pending_frame pending_frames[PENDING_FRAMES_MAX];
+static uint8_t pending_frames_head;
+static uint8_t pending_frames_count;
+static struct k_spinlock pending_commands_lock;
+
+/* Records are numbered in the order they are queued, and written to the UART in that order */
+K_MSGQ_DEFINE(forward_msgq, sizeof(struct forward_record), FORWARD_QUEUE_SIZE, 4);
+static K_MUTEX_DEFINE(forward_mutex);
+static struct k_work forward_work;
+static uint32_t records_queued;
+static uint32_t records_written;
+static atomic_t gateway_acks = ATOMIC_INIT(0);
+static struct k_work gateway_ack_work;
+static struct k_work_delayable pending_commands_timeout_work;
+
+/* Hot standby: the active server of a shard replicates its state to the standby servers */
+static bool server_active = !IS_ENABLED(CONFIG_SERVER_STANDBY);
+static uint8_t server_epoch;
+static int64_t last_heartbeat_time;
+static struct k_work_delayable heartbeat_work;
+static struct k_work_delayable failover_work;
+
+/* Group notification of the status changes */
+static struct k_work status_notify_work;
+static uint32_t status_notifications;
+
 struct server_context {
     struct otInstance *ot;
     ressources_status_request_callback_t on_ressources_status_request;
@@ -32,6 +124,8 @@ struct server_context {
     bool power_strip_r2_status;
     bool power_strip_r3_status;
     bool power_strip_r4_status;
+    /* Bumped from the UART ISR, read from the OpenThread thread */
+    atomic_t state_version;
 };
 
 static struct server_context srv_context = {
@@ -89,6 +183,22 @@ static otCoapResource power_strip_status_resource = {
     .mNext = NULL,
 };
 
+/**@brief Definition of CoAP resources for the single power strip relays, context is the relay number. */
+static otCoapResource power_strip_relay_resources[POWER_STRIP_RELAYS_COUNT] = {
+    { .mUriPath = POWER_STRIP_URI_PATH "/1", .mHandler = NULL, .mContext = NULL, .mNext = NULL },
+    { .mUriPath = POWER_STRIP_URI_PATH "/2", .mHandler = NULL, .mContext = NULL, .mNext = NULL },
+    { .mUriPath = POWER_STRIP_URI_PATH "/3", .mHandler = NULL, .mContext = NULL, .mNext = NULL },
+    { .mUriPath = POWER_STRIP_URI_PATH "/4", .mHandler = NULL, .mContext = NULL, .mNext = NULL },
+};
+
+/**@brief Definition of CoAP resources for state replication between servers. */
+static otCoapResource replication_resource = {
+    .mUriPath = REPLICATION_URI_PATH,
+    .mHandler = NULL,
+    .mContext = NULL,
+    .mNext = NULL,
+};
+
 /**@brief Definition of CoAP resources for commands. */
 static otCoapResource commands_resource = {
     .mUriPath = COMMANDS_URI_PATH,
@@ -97,25 +207,74 @@ static otCoapResource commands_resource = {
     .mNext = NULL,
 };
 
+static uint32_t state_version_get(void)
+{
+    return (uint32_t)atomic_get(&srv_context.state_version);
+}
+
+/* Replicate the new state to the standby servers, may be called from ISR */
+static void server_state_changed(void)
+{
+    atomic_inc(&srv_context.state_version);
+    if (server_active) {
+        k_work_reschedule(&heartbeat_work, K_NO_WAIT);
+        if (IS_ENABLED(CONFIG_STATUS_GROUP_NOTIFY)) {
+            k_work_submit(&status_notify_work);
+        }
+    }
+}
+
+/* Set a status, the state version only changes with the status so that the cached copies stay valid */
+static void server_status_set(bool *status, bool new_status, const char *name)
+{
+    if (*status == new_status) {
+        return;
+    }
+    *status = new_status;
+    printk("SERVER [DEBBUG]: New %s status: %s \n\r", name, new_status ? "true" : "false");
+    server_state_changed();
+}
+
 void set_wifi_status(bool new_status){
-    srv_context.wifi_status = new_status;
-    printk("SERVER [DEBBUG]: New wifi status: %s \n\r", srv_context.wifi_status ? "true" : "false");
+    server_status_set(&srv_context.wifi_status, new_status, "wifi");
 }
 void set_presence_status(bool new_status){
-    srv_context.presence_status = new_status;
-    printk("SERVER [DEBBUG]: New presence status: %s \n\r", srv_context.presence_status ? "true" : "false");
+    server_status_set(&srv_context.presence_status, new_status, "presence");
 }
 void set_electrical_status(bool new_status){
-    srv_context.electrical_status = new_status;
-    printk("SERVER [DEBBUG]: New electrical status: %s \n\r", srv_context.electrical_status ? "true" : "false");
+    server_status_set(&srv_context.electrical_status, new_status, "electrical");
 }
 
 void set_power_strip_status(bool new_r1_status, bool new_r2_status, bool new_r3_status, bool new_r4_status){
-    srv_context.power_strip_r1_status = new_r1_status;
-    srv_context.power_strip_r2_status = new_r2_status;
-    srv_context.power_strip_r3_status = new_r3_status;
-    srv_context.power_strip_r4_status = new_r4_status;
+    uint8_t values = (new_r1_status ? BIT(0) : 0) | (new_r2_status ? BIT(1) : 0) |
+                     (new_r3_status ? BIT(2) : 0) | (new_r4_status ? BIT(3) : 0);
+
+    set_power_strip_relays(BIT_MASK(POWER_STRIP_RELAYS_COUNT), values);
+}
+
+void set_power_strip_relays(uint8_t mask, uint8_t values){
+    bool *relays_status[POWER_STRIP_RELAYS_COUNT] = {
+        &srv_context.power_strip_r1_status,
+        &srv_context.power_strip_r2_status,
+        &srv_context.power_strip_r3_status,
+        &srv_context.power_strip_r4_status,
+    };
+    bool changed = false;
+
+    for (int i = 0; i < POWER_STRIP_RELAYS_COUNT; i++) {
+        if (mask & BIT(i)) {
+            bool status = (values & BIT(i)) != 0;
+            changed = changed || (*relays_status[i] != status);
+            *relays_status[i] = status;
+        }
+    }
+
+    // Nothing to replicate or notify
+    if (!changed) {
+        return;
+    }
     printk("SERVER [DEBBUG]: New power strip status R1:%d  R2:%d  R3:%d  R4:%d \n\r", srv_context.power_strip_r1_status, srv_context.power_strip_r2_status, srv_context.power_strip_r3_status, srv_context.power_strip_r4_status);
+    server_state_changed();
 }
 
 void print_ressources_status(void){
@@ -126,27 +285,234 @@ void print_ressources_status(void){
      printk("power strip: R1:%d R2:%d R3:%d R4:%d\n\r", srv_context.power_strip_r1_status, srv_context.power_strip_r2_status, srv_context.power_strip_r3_status, srv_context.power_strip_r4_status);   
 }
 
+/* Keep the address of the clients sending keep alive msgs to address them by device id */
+static void client_device_update(const uint8_t *msg, uint16_t len, const otMessageInfo *message_info)
+{
+    uint16_t prefix_len = strlen(KEEP_ALIVE_PREFIX);
+
+    if ((len <= prefix_len) || (strncmp(msg, KEEP_ALIVE_PREFIX, prefix_len) != 0)) {
+        return;
+    }
+
+    int device_id = atoi(&msg[prefix_len]);
+    if ((device_id <= 0) || (device_id >= CLIENT_DEVICES_MAX)) {
+        return;
+    }
+
+    client_devices[device_id].known = true;
+    client_devices[device_id].addr = message_info->mPeerAddr;
+    atomic_or(&keep_alive_devices, BIT(device_id));
+    explicit_keep_alives ++;
+}
+
+static void pending_command_records_set(int slot, uint32_t first_record, uint32_t last_record);
+
+/* Queue each record of a commands msg to be forwarded to the gateway: cmd;cmd;...
+ * The records of a client request also update the known client addresses.
+ * The records range of the reserved pending command slot, if not negative, is set before
+ * they are queued, so that the frame of its last record cannot be reported before.
+ * Returns the number of records queued, -ENOBUFS when they do not all fit in the queue.
+ * The caller submits forward_work.
+ */
+static int commands_records_queue(const uint8_t *msg, uint16_t len, const otMessageInfo *message_info,
+                                  int pending_slot)
+{
+    struct forward_record record;
+    uint16_t start = 0;
+    int records = 0;
+
+    // Commands sent by the clients can be NULL terminated
+    len = strnlen((const char *)msg, len);
+
+    for (uint16_t i = 0; i <= len; i++) {
+        if ((i == len) || (msg[i] == COMMANDS_RECORD_SEPARATOR)) {
+            records += (i > start) ? 1 : 0;
+            start = i + 1;
+        }
+    }
+
+    k_mutex_lock(&forward_mutex, K_FOREVER);
+
+    if (k_msgq_num_free_get(&forward_msgq) < records) {
+        k_mutex_unlock(&forward_mutex);
+        return -ENOBUFS;
+    }
+
+    if ((pending_slot >= 0) && (records > 0)) {
+        pending_command_records_set(pending_slot, records_queued + 1, records_queued + records);
+    }
+
+    record.received_time = k_uptime_get();
+    start = 0;
+    while (start < len) {
+        uint16_t end = start;
+        while ((end < len) && (msg[end] != COMMANDS_RECORD_SEPARATOR)) {
+            end ++;
+        }
+
+        if (end > start) {
+            record.len = MIN(end - start, FORWARD_RECORD_MAX_SIZE);
+            memcpy(record.buf, &msg[start], record.len);
+            record.buf[record.len] = '\0';
+            if (message_info != NULL) {
+                client_device_update(record.buf, record.len, message_info);
+            }
+            k_msgq_put(&forward_msgq, &record, K_NO_WAIT);
+            records_queued ++;
+        }
+        start = end + 1;
+    }
+
+    k_mutex_unlock(&forward_mutex);
+
+    if (records > 1) {
+        printk("THREAD [DEBBUG]: %d commands unpacked from a single request\r\n", records);
+    }
+    return records;
+}
+
+/* Write the queued records to the UART, in the order they were queued */
+static void commands_forward_handler(struct k_work *item)
+{
+    struct forward_record record;
+
+    ARG_UNUSED(item);
+
+    while (k_msgq_get(&forward_msgq, &record, K_NO_WAIT) == 0) {
+        srv_context.on_commands_request(record.buf, record.len, record.received_time);
+    }
+}
+
+/* Forward a record of the server itself to the gateway: implicit keep alive msgs, failover reports */
+static void gateway_record_forward(const char *record)
+{
+    if (commands_records_queue((const uint8_t *)record, strlen(record), NULL, -1) < 0) {
+        printk("THREAD [ERROR]: Forward queue full, %s dropped\r\n", record);
+        return;
+    }
+    k_work_submit(&forward_work);
+}
+
+/* Any request of a known client proves it is alive, its keep alive msg is forwarded on its behalf
+ * at the end of the keep alive period
+ */
+static void client_activity_update(const otMessageInfo *message_info)
+{
+    for (int device_id = 1; device_id < CLIENT_DEVICES_MAX; device_id++) {
+        struct client_device *device = &client_devices[device_id];
+
+        if (device->known && (memcmp(&device->addr, &message_info->mPeerAddr, sizeof(otIp6Address)) == 0)) {
+            atomic_or(&active_devices, BIT(device_id));
+            return;
+        }
+    }
+}
+
+/* Forward a keep alive msg for the devices with requests but no keep alive msg during the period */
+static void keep_alive_period_end(struct k_work *item)
+{
+    char keep_alive[8];
+
+    ARG_UNUSED(item);
+
+    k_work_reschedule(&keep_alive_work, K_MSEC(CONFIG_CLIENT_KEEP_ALIVE_PERIOD_MS));
+
+    uint32_t implicit = (uint32_t)atomic_clear(&active_devices) & ~(uint32_t)atomic_clear(&keep_alive_devices);
+    if (!server_active) {
+        return;
+    }
+
+    for (int device_id = 1; device_id < CLIENT_DEVICES_MAX; device_id++) {
+        if (!(implicit & BIT(device_id))) {
+            continue;
+        }
+        implicit_keep_alives ++;
+        snprintk(keep_alive, sizeof(keep_alive), "%s%d", KEEP_ALIVE_PREFIX, device_id);
+        printk("THREAD [DEBBUG]: Implicit keep alive of device %d (explicit: %d implicit: %d)\r\n",
+               device_id, explicit_keep_alives, implicit_keep_alives);
+        gateway_record_forward(keep_alive);
+    }
+}
+
+/* Piggyback the response in the acknowledgment of confirmable requests */
+static otError response_init(otMessage *response, const otMessage *request_message, otCoapCode code)
+{
+    if (otCoapMessageGetType(request_message) == OT_COAP_TYPE_CONFIRMABLE) {
+        return otCoapMessageInitResponse(response, request_message, OT_COAP_TYPE_ACKNOWLEDGMENT, code);
+    }
+
+    otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE, code);
+    return otCoapMessageSetToken(response, otCoapMessageGetToken(request_message),
+                                 otCoapMessageGetTokenLength(request_message));
+}
+
+/* Check if the requester (a caching proxy) already has the current state */
+static bool status_etag_match(const otMessage *request_message)
+{
+    otCoapOptionIterator iterator;
+    const otCoapOption *option;
+    uint8_t etag[sizeof(uint32_t)];
+
+    if (otCoapOptionIteratorInit(&iterator, request_message) != OT_ERROR_NONE) {
+        return false;
+    }
+
+    option = otCoapOptionIteratorGetFirstOptionMatching(&iterator, OT_COAP_OPTION_E_TAG);
+    if ((option == NULL) || (option->mLength != sizeof(etag)) ||
+        (otCoapOptionIteratorGetOptionValue(&iterator, etag) != OT_ERROR_NONE)) {
+        return false;
+    }
+
+    return sys_get_be32(etag) == state_version_get();
+}
+
+/* Append the state version as ETag and the freshness lifetime of the status */
+static otError status_cache_options_append(otMessage *response)
+{
+    uint8_t etag[sizeof(uint32_t)];
+    otError error;
+
+    sys_put_be32(state_version_get(), etag);
+    error = otCoapMessageAppendOption(response, OT_COAP_OPTION_E_TAG, sizeof(etag), etag);
+    if (error != OT_ERROR_NONE) {
+        return error;
+    }
+
+    return otCoapMessageAppendMaxAgeOption(response, CONFIG_STATUS_MAX_AGE_S);
+}
+
 static otError ressources_status_response_send(otMessage *request_message,
                       const otMessageInfo *message_info)
 {
     otError error = OT_ERROR_NO_BUFS;
     otMessage *response;    
+    // Freed at end, also reached before the allocation by the 2.03 Valid response
+    uint8_t *payload = NULL;
 
     response = otCoapNewMessage(srv_context.ot, NULL);
     if (response == NULL) {
         goto end;
     }
 
-    otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE,
-              OT_COAP_CODE_CONTENT);
+    // Only the validation is sent when the requester has the current state
+    bool valid = status_etag_match(request_message);
 
-    error = otCoapMessageSetToken(
-        response, otCoapMessageGetToken(request_message),
-        otCoapMessageGetTokenLength(request_message));
+    error = response_init(response, request_message,
+              valid ? OT_COAP_CODE_VALID : OT_COAP_CODE_CONTENT);
     if (error != OT_ERROR_NONE) {
         goto end;
     }
 
+    error = status_cache_options_append(response);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    if (valid) {
+        error = otCoapSendResponse(srv_context.ot, response, message_info);
+        goto end;
+    }
+
     error = otCoapMessageSetPayloadMarker(response);
     if (error != OT_ERROR_NONE) {
         goto end;
@@ -178,7 +544,7 @@ static otError ressources_status_response_send(otMessage *request_message,
 
     // Get payload size
     uint16_t payload_size = wifi_payload_size + presence_payload_size + electrical_payload_size + power_strip_payload_size + 1;
-    uint8_t *payload = (uint8_t*) malloc(payload_size * sizeof(uint8_t));
+    payload = (uint8_t*) malloc(payload_size * sizeof(uint8_t));
 
     if(payload == NULL) {
         printk("THREAD [ERROR]: Error in payload memory alocation");
@@ -235,8 +601,9 @@ static void ressources_status_request_handler(void *context, otMessage *message,
 
     printk("THREAD [DEBBUG]: Received ressources status request\r\n");
 
-    if ((otCoapMessageGetType(message) == OT_COAP_TYPE_NON_CONFIRMABLE) &&
-        (otCoapMessageGetCode(message) == OT_COAP_CODE_GET)) {
+    if (otCoapMessageGetCode(message) == OT_COAP_CODE_GET) {
+        client_activity_update(message_info);
+
         msg_info = *message_info;
         memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
 
@@ -258,12 +625,8 @@ static otError wifi_status_response_send(otMessage *request_message,
         goto end;
     }
 
-    otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE,
+    error = response_init(response, request_message,
               OT_COAP_CODE_CONTENT);
-
-    error = otCoapMessageSetToken(
-        response, otCoapMessageGetToken(request_message),
-        otCoapMessageGetTokenLength(request_message));
     if (error != OT_ERROR_NONE) {
         goto end;
     }
@@ -304,8 +667,9 @@ static void wifi_status_request_handler(void *context, otMessage *message,
 
     printk("THREAD [DEBBUG]: Received wifi status request\r\n");
 
-    if ((otCoapMessageGetType(message) == OT_COAP_TYPE_NON_CONFIRMABLE) &&
-        (otCoapMessageGetCode(message) == OT_COAP_CODE_GET)) {
+    if (otCoapMessageGetCode(message) == OT_COAP_CODE_GET) {
+        client_activity_update(message_info);
+
         msg_info = *message_info;
         memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
 
@@ -327,12 +691,8 @@ static otError presence_status_response_send(otMessage *request_message,
         goto end;
     }
 
-    otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE,
+    error = response_init(response, request_message,
               OT_COAP_CODE_CONTENT);
-
-    error = otCoapMessageSetToken(
-        response, otCoapMessageGetToken(request_message),
-        otCoapMessageGetTokenLength(request_message));
     if (error != OT_ERROR_NONE) {
         goto end;
     }
@@ -373,8 +733,9 @@ static void presence_status_request_handler(void *context, otMessage *message,
 
     printk("THREAD [DEBBUG]: Received presence status request\r\n");
 
-    if ((otCoapMessageGetType(message) == OT_COAP_TYPE_NON_CONFIRMABLE) &&
-        (otCoapMessageGetCode(message) == OT_COAP_CODE_GET)) {
+    if (otCoapMessageGetCode(message) == OT_COAP_CODE_GET) {
+        client_activity_update(message_info);
+
         msg_info = *message_info;
         memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
 
@@ -396,12 +757,8 @@ static otError electrical_status_response_send(otMessage *request_message,
         goto end;
     }
 
-    otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE,
+    error = response_init(response, request_message,
               OT_COAP_CODE_CONTENT);
-
-    error = otCoapMessageSetToken(
-        response, otCoapMessageGetToken(request_message),
-        otCoapMessageGetTokenLength(request_message));
     if (error != OT_ERROR_NONE) {
         goto end;
     }
@@ -442,8 +799,9 @@ static void electrical_status_request_handler(void *context, otMessage *message,
 
     printk("THREAD [DEBBUG]: Received electrical status request\r\n");
 
-    if ((otCoapMessageGetType(message) == OT_COAP_TYPE_NON_CONFIRMABLE) &&
-        (otCoapMessageGetCode(message) == OT_COAP_CODE_GET)) {
+    if (otCoapMessageGetCode(message) == OT_COAP_CODE_GET) {
+        client_activity_update(message_info);
+
         msg_info = *message_info;
         memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
 
@@ -465,16 +823,25 @@ static otError power_strip_status_response_send(otMessage *request_message,
         goto end;
     }
 
-    otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE,
-              OT_COAP_CODE_CONTENT);
+    // Only the validation is sent when the requester has the current state
+    bool valid = status_etag_match(request_message);
+
+    error = response_init(response, request_message,
+              valid ? OT_COAP_CODE_VALID : OT_COAP_CODE_CONTENT);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
 
-    error = otCoapMessageSetToken(
-        response, otCoapMessageGetToken(request_message),
-        otCoapMessageGetTokenLength(request_message));
+    error = status_cache_options_append(response);
     if (error != OT_ERROR_NONE) {
         goto end;
     }
 
+    if (valid) {
+        error = otCoapSendResponse(srv_context.ot, response, message_info);
+        goto end;
+    }
+
     error = otCoapMessageSetPayloadMarker(response);
     if (error != OT_ERROR_NONE) {
         goto end;
@@ -505,6 +872,120 @@ end:
     return error;
 }
 
+/* Response to a single relay or relays masked update request, payload may be NULL */
+static otError power_strip_update_response_send(otMessage *request_message, const otMessageInfo *message_info,
+                                                otCoapCode code, const char *payload)
+{
+    otError error = OT_ERROR_NO_BUFS;
+    otMessage *response;
+
+    response = otCoapNewMessage(srv_context.ot, NULL);
+    if (response == NULL) {
+        goto end;
+    }
+
+    error = response_init(response, request_message, code);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    if (payload != NULL) {
+        error = otCoapMessageSetPayloadMarker(response);
+        if (error != OT_ERROR_NONE) {
+            goto end;
+        }
+
+        error = otMessageAppend(response, payload, strlen(payload));
+        if (error != OT_ERROR_NONE) {
+            goto end;
+        }
+    }
+
+    error = otCoapSendResponse(srv_context.ot, response, message_info);
+
+end:
+    if (error != OT_ERROR_NONE && response != NULL) {
+        otMessageFree(response);
+    }
+
+    return error;
+}
+
+/* Apply a relays masked update request: mask:MV */
+static void power_strip_mask_request_process(otMessage *message, const otMessageInfo *message_info)
+{
+    char payload[sizeof(RELAYS_MASK_PAYLOAD_PREFIX) + 2];
+    uint16_t payload_len;
+    uint8_t mask;
+    uint8_t values;
+
+    payload_len = otMessageRead(message, otMessageGetOffset(message), payload, sizeof(payload) - 1);
+    payload[payload_len] = '\0';
+
+    if (relays_mask_payload_parse(payload, payload_len, &mask, &values)) {
+        printk("THREAD [ERROR]: Unexpected relays masked update: %s\r\n", payload);
+        power_strip_update_response_send(message, message_info, OT_COAP_CODE_BAD_REQUEST, NULL);
+        return;
+    }
+
+    if (power_strip_update_response_send(message, message_info, OT_COAP_CODE_CHANGED, NULL) == OT_ERROR_NONE) {
+        set_power_strip_relays(mask, values);
+    }
+}
+
+static void power_strip_relay_request_handler(void *context, otMessage *message,
+                     const otMessageInfo *message_info)
+{
+    int relay_number = POINTER_TO_INT(context);
+    uint8_t relay_bit = BIT(relay_number - 1);
+    otMessageInfo msg_info;
+
+    printk("THREAD [DEBBUG]: Received power strip relay %d request\r\n", relay_number);
+
+    client_activity_update(message_info);
+
+    msg_info = *message_info;
+    memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
+
+    if (otCoapMessageGetCode(message) == OT_COAP_CODE_GET) {
+        const bool *relays_status[POWER_STRIP_RELAYS_COUNT] = {
+            &srv_context.power_strip_r1_status,
+            &srv_context.power_strip_r2_status,
+            &srv_context.power_strip_r3_status,
+            &srv_context.power_strip_r4_status,
+        };
+        char payload[] = RELAY_PAYLOAD_PREFIX "X";
+
+        payload[strlen(RELAY_PAYLOAD_PREFIX)] = *relays_status[relay_number - 1] ? '1' : '0';
+        power_strip_update_response_send(message, &msg_info, OT_COAP_CODE_CONTENT, payload);
+        return;
+    }
+
+    if (otCoapMessageGetCode(message) != OT_COAP_CODE_PUT) {
+        printk("THREAD [ERROR]: Power strip relay handler - Unexpected CoAP code\r\n");
+        power_strip_update_response_send(message, &msg_info, OT_COAP_CODE_METHOD_NOT_ALLOWED, NULL);
+        return;
+    }
+
+    char payload[sizeof(RELAY_PAYLOAD_PREFIX) + 1];
+    uint16_t payload_len;
+    uint16_t prefix_len = strlen(RELAY_PAYLOAD_PREFIX);
+
+    payload_len = otMessageRead(message, otMessageGetOffset(message), payload, sizeof(payload) - 1);
+    payload[payload_len] = '\0';
+
+    if ((payload_len != prefix_len + 1) || (strncmp(payload, RELAY_PAYLOAD_PREFIX, prefix_len) != 0) ||
+        ((payload[prefix_len] != '0') && (payload[prefix_len] != '1'))) {
+        printk("THREAD [ERROR]: Unexpected relay update: %s\r\n", payload);
+        power_strip_update_response_send(message, &msg_info, OT_COAP_CODE_BAD_REQUEST, NULL);
+        return;
+    }
+
+    if (power_strip_update_response_send(message, &msg_info, OT_COAP_CODE_CHANGED, NULL) == OT_ERROR_NONE) {
+        set_power_strip_relays(relay_bit, (payload[prefix_len] == '1') ? relay_bit : 0);
+    }
+}
+
 static void power_strip_status_request_handler(void *context, otMessage *message,
                      const otMessageInfo *message_info)
 {
@@ -515,8 +996,19 @@ static void power_strip_status_request_handler(void *context, otMessage *message
 
     printk("THREAD [DEBBUG]: Received power strip status request\r\n");
 
-    if ((otCoapMessageGetType(message) == OT_COAP_TYPE_NON_CONFIRMABLE) &&
-        (otCoapMessageGetCode(message) == OT_COAP_CODE_GET)) {
+    if (otCoapMessageGetCode(message) == OT_COAP_CODE_PUT) {
+        client_activity_update(message_info);
+
+        msg_info = *message_info;
+        memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
+
+        power_strip_mask_request_process(message, &msg_info);
+        return;
+    }
+
+    if (otCoapMessageGetCode(message) == OT_COAP_CODE_GET) {
+        client_activity_update(message_info);
+
         msg_info = *message_info;
         memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
 
@@ -528,7 +1020,7 @@ static void power_strip_status_request_handler(void *context, otMessage *message
 }
 
 static otError commands_msg_response_send(otMessage *request_message,
-                      const otMessageInfo *message_info)
+                      const otMessageInfo *message_info, otCoapCode code, const char *payload)
 {
     otError error = OT_ERROR_NO_BUFS;
     otMessage *response;    
@@ -538,12 +1030,48 @@ static otError commands_msg_response_send(otMessage *request_message,
         goto end;
     }
 
+    error = response_init(response, request_message, code);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    error = otCoapMessageSetPayloadMarker(response);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    error = otMessageAppend(response, payload, strlen(payload) + 1);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    error = otCoapSendResponse(srv_context.ot, response, message_info);
+
+end:
+    if (error != OT_ERROR_NONE && response != NULL) {
+        otMessageFree(response);
+    }
+
+    return error;
+}
+
+static void commands_separate_response_send(struct pending_command *command, bool acknowledged)
+{
+    otError error = OT_ERROR_NO_BUFS;
+    otMessage *response;
+    char payload[32];
+
+    response = otCoapNewMessage(srv_context.ot, NULL);
+    if (response == NULL) {
+        goto end;
+    }
+
+    // A command whose frame could not be written to the UART is answered right away
     otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE,
-              OT_COAP_CODE_CONTENT);
+              acknowledged ? OT_COAP_CODE_CONTENT :
+              command->failed ? OT_COAP_CODE_BAD_GATEWAY : OT_COAP_CODE_GATEWAY_TIMEOUT);
 
-    error = otCoapMessageSetToken(
-        response, otCoapMessageGetToken(request_message),
-        otCoapMessageGetTokenLength(request_message));
+    error = otCoapMessageSetToken(response, command->token, command->token_len);
     if (error != OT_ERROR_NONE) {
         goto end;
     }
@@ -553,11 +1081,235 @@ static otError commands_msg_response_send(otMessage *request_message,
         goto end;
     }
 
-    // Append presence status to payload
-    uint8_t *payload = "CMD:OK";
-    uint16_t payload_size = strlen(payload) + 1;
+    if (acknowledged) {
+        snprintk(payload, sizeof(payload), "%s %s%d", COMMANDS_OK, COMMANDS_LATENCY,
+             (uint32_t)(k_uptime_get() - command->arrival_time));
+    } else {
+        snprintk(payload, sizeof(payload), "%s", command->failed ? COMMANDS_ERROR : COMMANDS_TIMEOUT);
+    }
+    printk("THREAD [DEBBUG]: Commands separate response payload: %s\r\n", payload);
 
-    error = otMessageAppend(response, payload, payload_size);
+    error = otMessageAppend(response, payload, strlen(payload) + 1);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    error = otCoapSendResponse(srv_context.ot, response, &command->msg_info);
+
+end:
+    if (error != OT_ERROR_NONE && response != NULL) {
+        otMessageFree(response);
+    }
+    if (error != OT_ERROR_NONE) {
+        printk("THREAD [ERROR]: Cannot send commands separate response, error: %d\r\n", error);
+    }
+}
+
+/* Answer the commands whose last record was in the oldest UART frame acknowledged by the gateway */
+static void gateway_ack_handler(struct k_work *item)
+{
+    struct pending_command acked[PENDING_COMMANDS_MAX];
+    int acked_count;
+
+    ARG_UNUSED(item);
+
+    while (atomic_get(&gateway_acks) > 0) {
+        atomic_dec(&gateway_acks);
+        acked_count = 0;
+
+        k_spinlock_key_t key = k_spin_lock(&pending_commands_lock);
+        bool frame_pending = pending_frames_count > 0;
+        if (frame_pending) {
+            uint32_t acked_record = pending_frames[pending_frames_head].last_record;
+            pending_frames_head = (pending_frames_head + 1) % PENDING_FRAMES_MAX;
+            pending_frames_count --;
+            for (int i = 0; i < PENDING_COMMANDS_MAX; i++) {
+                if (pending_commands[i].in_use && pending_commands[i].queued &&
+                    ((int32_t)(pending_commands[i].last_record - acked_record) <= 0)) {
+                    acked[acked_count++] = pending_commands[i];
+                    pending_commands[i].in_use = false;
+                }
+            }
+        }
+        k_spin_unlock(&pending_commands_lock, key);
+
+        if (!frame_pending) {
+            printk("THREAD [ERROR]: Gateway ack received without pending frame\r\n");
+            continue;
+        }
+        // Frame of records forwarded by the server itself, or of commands already timed out
+        if (acked_count == 0) {
+            continue;
+        }
+
+        openthread_api_mutex_lock(openthread_get_default_context());
+        for (int i = 0; i < acked_count; i++) {
+            commands_separate_response_send(&acked[i], true);
+        }
+        openthread_api_mutex_unlock(openthread_get_default_context());
+    }
+}
+
+/* Answer the commands not acknowledged by the gateway in time, or not written to the UART */
+static void pending_commands_timeout_handler(struct k_work *item)
+{
+    struct pending_command expired[PENDING_COMMANDS_MAX];
+    int expired_count = 0;
+    int64_t next_expiry = 0;
+    int64_t now = k_uptime_get();
+
+    ARG_UNUSED(item);
+
+    k_spinlock_key_t key = k_spin_lock(&pending_commands_lock);
+    for (int i = 0; i < PENDING_COMMANDS_MAX; i++) {
+        if (!pending_commands[i].in_use) {
+            continue;
+        }
+        int64_t expiry = pending_commands[i].arrival_time + CONFIG_GATEWAY_ACK_TIMEOUT_MS;
+        // A reserved command is set or released by its request handler
+        if (pending_commands[i].queued && (pending_commands[i].failed || (expiry <= now))) {
+            expired[expired_count++] = pending_commands[i];
+            pending_commands[i].in_use = false;
+        } else if (next_expiry == 0 || expiry < next_expiry) {
+            next_expiry = expiry;
+        }
+    }
+    // Frames whose acknowledgment was lost, so that the following acknowledgments match their frame
+    while ((pending_frames_count > 0) &&
+           (pending_frames[pending_frames_head].sent_time + CONFIG_GATEWAY_ACK_TIMEOUT_MS <= now)) {
+        pending_frames_head = (pending_frames_head + 1) % PENDING_FRAMES_MAX;
+        pending_frames_count --;
+    }
+    k_spin_unlock(&pending_commands_lock, key);
+
+    if (expired_count > 0) {
+        openthread_api_mutex_lock(openthread_get_default_context());
+        for (int i = 0; i < expired_count; i++) {
+            commands_separate_response_send(&expired[i], false);
+        }
+        openthread_api_mutex_unlock(openthread_get_default_context());
+    }
+
+    if (next_expiry != 0) {
+        k_work_reschedule(&pending_commands_timeout_work, K_MSEC(next_expiry - now));
+    }
+}
+
+/* Reserve a slot to keep the command until the gateway acknowledges the frame of its last record,
+ * returns -1 if no slot is free. The records range is set when they are queued.
+ */
+static int pending_command_reserve(otMessage *request_message, const otMessageInfo *message_info)
+{
+    int slot = -1;
+
+    k_spinlock_key_t key = k_spin_lock(&pending_commands_lock);
+    for (int i = 0; i < PENDING_COMMANDS_MAX; i++) {
+        if (!pending_commands[i].in_use) {
+            pending_commands[i].in_use = true;
+            pending_commands[i].token_len = otCoapMessageGetTokenLength(request_message);
+            memcpy(pending_commands[i].token, otCoapMessageGetToken(request_message),
+                   pending_commands[i].token_len);
+            pending_commands[i].msg_info = *message_info;
+            pending_commands[i].arrival_time = k_uptime_get();
+            pending_commands[i].queued = false;
+            pending_commands[i].failed = false;
+            slot = i;
+            break;
+        }
+    }
+    k_spin_unlock(&pending_commands_lock, key);
+
+    return slot;
+}
+
+static void pending_command_records_set(int slot, uint32_t first_record, uint32_t last_record)
+{
+    k_spinlock_key_t key = k_spin_lock(&pending_commands_lock);
+    pending_commands[slot].first_record = first_record;
+    pending_commands[slot].last_record = last_record;
+    pending_commands[slot].queued = true;
+    k_spin_unlock(&pending_commands_lock, key);
+
+    k_work_schedule(&pending_commands_timeout_work, K_MSEC(CONFIG_GATEWAY_ACK_TIMEOUT_MS));
+}
+
+/* Free a reserved slot whose command has no record queued */
+static void pending_command_release(int slot)
+{
+    k_spinlock_key_t key = k_spin_lock(&pending_commands_lock);
+    pending_commands[slot].in_use = false;
+    k_spin_unlock(&pending_commands_lock, key);
+}
+
+void commands_uart_frame_sent(uint8_t records)
+{
+    if (!IS_ENABLED(CONFIG_COMMANDS_SEPARATE_RESPONSE)) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&pending_commands_lock);
+    records_written += records;
+    if (pending_frames_count == PENDING_FRAMES_MAX) {
+        // Oldest frame never acknowledged, its commands time out
+        pending_frames_head = (pending_frames_head + 1) % PENDING_FRAMES_MAX;
+        pending_frames_count --;
+    }
+    struct pending_frame *frame = &pending_frames[(pending_frames_head + pending_frames_count) % PENDING_FRAMES_MAX];
+    frame->last_record = records_written;
+    frame->sent_time = k_uptime_get();
+    pending_frames_count ++;
+    k_spin_unlock(&pending_commands_lock, key);
+}
+
+void commands_uart_frame_failed(uint8_t records)
+{
+    bool failed = false;
+
+    if (!IS_ENABLED(CONFIG_COMMANDS_SEPARATE_RESPONSE)) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&pending_commands_lock);
+    uint32_t first_failed = records_written + 1;
+    records_written += records;
+    for (int i = 0; i < PENDING_COMMANDS_MAX; i++) {
+        if (pending_commands[i].in_use && pending_commands[i].queued &&
+            ((int32_t)(pending_commands[i].last_record - first_failed) >= 0) &&
+            ((int32_t)(pending_commands[i].first_record - records_written) <= 0)) {
+            pending_commands[i].failed = true;
+            failed = true;
+        }
+    }
+    k_spin_unlock(&pending_commands_lock, key);
+
+    if (failed) {
+        k_work_reschedule(&pending_commands_timeout_work, K_NO_WAIT);
+    }
+}
+
+void commands_gateway_ack_received(void)
+{
+    if (!IS_ENABLED(CONFIG_COMMANDS_SEPARATE_RESPONSE)) {
+        return;
+    }
+
+    atomic_inc(&gateway_acks);
+    k_work_submit(&gateway_ack_work);
+}
+
+static otError commands_empty_ack_send(otMessage *request_message,
+                      const otMessageInfo *message_info)
+{
+    otError error = OT_ERROR_NO_BUFS;
+    otMessage *response;
+
+    response = otCoapNewMessage(srv_context.ot, NULL);
+    if (response == NULL) {
+        goto end;
+    }
+
+    error = otCoapMessageInitResponse(response, request_message,
+                      OT_COAP_TYPE_ACKNOWLEDGMENT, OT_COAP_CODE_EMPTY);
     if (error != OT_ERROR_NONE) {
         goto end;
     }
@@ -576,7 +1328,7 @@ static void commands_request_handler(void *context, otMessage *message,
                   const otMessageInfo *message_info)
 {
 
-    otError error;
+    otError error = OT_ERROR_NONE;
     otMessageInfo msg_info;
 
     ARG_UNUSED(context);
@@ -584,11 +1336,6 @@ static void commands_request_handler(void *context, otMessage *message,
     printk("THREAD [DEBBUG]: Commands message received\r\n");
     ARG_UNUSED(context);   
 
-    if (otCoapMessageGetType(message) != OT_COAP_TYPE_NON_CONFIRMABLE) {
-        printk("THREAD [ERROR]: Commands handler - Unexpected type of message");
-        goto end;
-    }
-
     if (otCoapMessageGetCode(message) != OT_COAP_CODE_PUT) {
         printk("THREAD [ERROR]: Commands handler - Unexpected CoAP code");
         goto end;
@@ -597,15 +1344,427 @@ static void commands_request_handler(void *context, otMessage *message,
     msg_info = *message_info;
     memset(&msg_info.mSockAddr, 0, sizeof(msg_info.mSockAddr));
 
-    error = commands_msg_response_send(message, &msg_info);
-    if (error == OT_ERROR_NONE) {
-        msg_len = otMessageRead(message, otMessageGetOffset(message), msg_buf, MSG_BUFF_SIZE);
-        srv_context.on_commands_request(&msg_buf, msg_len);
-    }   
+    // The slot is reserved first: the records can be written and acknowledged as soon as they are queued
+    int pending_slot = IS_ENABLED(CONFIG_COMMANDS_SEPARATE_RESPONSE) ?
+                       pending_command_reserve(message, &msg_info) : -1;
+    msg_len = otMessageRead(message, otMessageGetOffset(message), msg_buf, MSG_BUFF_SIZE);
+    int records = commands_records_queue(msg_buf, msg_len, message_info, pending_slot);
+    if ((pending_slot >= 0) && (records <= 0)) {
+        pending_command_release(pending_slot);
+        pending_slot = -1;
+    }
+    if (records < 0) {
+        printk("THREAD [ERROR]: Forward queue full, commands dropped\r\n");
+        error = commands_msg_response_send(message, &msg_info, OT_COAP_CODE_SERVICE_UNAVAILABLE, COMMANDS_ERROR);
+        goto end;
+    }
+
+    if (pending_slot >= 0) {
+        // Answer once the gateway acknowledged the last record of the request
+        if (otCoapMessageGetType(message) == OT_COAP_TYPE_CONFIRMABLE) {
+            error = commands_empty_ack_send(message, &msg_info);
+        }
+    } else {
+        if (IS_ENABLED(CONFIG_COMMANDS_SEPARATE_RESPONSE) && (records > 0)) {
+            printk("THREAD [ERROR]: Too many commands waiting for the gateway\r\n");
+        }
+        error = commands_msg_response_send(message, &msg_info, OT_COAP_CODE_CONTENT, COMMANDS_OK);
+    }
+
+    k_work_submit(&forward_work);
+    client_activity_update(message_info);
 end:
+    if (error != OT_ERROR_NONE) {
+        printk("THREAD [ERROR]: Cannot answer commands msg, error: %d\r\n", error);
+    }
     return;
 }
 
+/* Resolve a downlink target: r<rloc16>, e<mesh-local EID>, d<device id> or g<group id> */
+static otError downlink_target_resolve(const char *target, otIp6Address *addr)
+{
+    char *end;
+
+    switch (target[0]) {
+    case DOWNLINK_TARGET_RLOC16: {
+        uint16_t rloc16 = strtoul(&target[1], &end, 16);
+        if (end == &target[1]) {
+            return OT_ERROR_INVALID_ARGS;
+        }
+        // RLOC: mesh-local prefix + 0000:00ff:fe00:<rloc16>
+        memset(addr, 0, sizeof(*addr));
+        memcpy(addr->mFields.m8, otThreadGetMeshLocalPrefix(srv_context.ot)->m8, 8);
+        addr->mFields.m8[11] = 0xff;
+        addr->mFields.m8[12] = 0xfe;
+        addr->mFields.m8[14] = rloc16 >> 8;
+        addr->mFields.m8[15] = rloc16 & 0xff;
+        return OT_ERROR_NONE;
+    }
+    case DOWNLINK_TARGET_ML_EID:
+        return otIp6AddressFromString(&target[1], addr);
+    case DOWNLINK_TARGET_DEVICE_ID: {
+        int device_id = strtol(&target[1], &end, 10);
+        if ((end == &target[1]) || (device_id <= 0) || (device_id >= CLIENT_DEVICES_MAX) ||
+            !client_devices[device_id].known) {
+            return OT_ERROR_NOT_FOUND;
+        }
+        *addr = client_devices[device_id].addr;
+        return OT_ERROR_NONE;
+    }
+    case DOWNLINK_TARGET_GROUP: {
+        uint16_t group_id = strtoul(&target[1], &end, 16);
+        if ((end == &target[1]) || (group_id == 0)) {
+            return OT_ERROR_INVALID_ARGS;
+        }
+        const uint8_t group_addr[] = GROUP_MULTICAST_ADDR(group_id);
+        memcpy(addr->mFields.m8, group_addr, sizeof(group_addr));
+        return OT_ERROR_NONE;
+    }
+    default:
+        return OT_ERROR_INVALID_ARGS;
+    }
+}
+
+static void downlink_response_handler(void *context, otMessage *message,
+                      const otMessageInfo *message_info, otError result)
+{
+    ARG_UNUSED(context);
+    ARG_UNUSED(message);
+    ARG_UNUSED(message_info);
+
+    if (result == OT_ERROR_NONE) {
+        printk("THREAD [DEBBUG]: Downlink request acknowledged by client\r\n");
+    } else {
+        printk("THREAD [ERROR]: Downlink request failed, error: %d\r\n", result);
+    }
+}
+
+int ot_coap_send_downlink(const char *target, const uint8_t *payload, uint16_t payload_len)
+{
+    otError error = OT_ERROR_NO_BUFS;
+    otMessage *request = NULL;
+    otMessageInfo message_info;
+
+    openthread_api_mutex_lock(openthread_get_default_context());
+
+    memset(&message_info, 0, sizeof(message_info));
+    message_info.mPeerPort = COAP_PORT;
+
+    error = downlink_target_resolve(target, &message_info.mPeerAddr);
+    if (error != OT_ERROR_NONE) {
+        printk("THREAD [ERROR]: Unknown downlink target: %s\r\n", target);
+        goto end;
+    }
+
+    request = otCoapNewMessage(srv_context.ot, NULL);
+    if (request == NULL) {
+        error = OT_ERROR_NO_BUFS;
+        goto end;
+    }
+
+    // One non confirmable request reaches all the members of a multicast group
+    bool multicast = message_info.mPeerAddr.mFields.m8[0] == 0xff;
+    otCoapMessageInit(request, multicast ? OT_COAP_TYPE_NON_CONFIRMABLE : OT_COAP_TYPE_CONFIRMABLE,
+              OT_COAP_CODE_PUT);
+    otCoapMessageGenerateToken(request, OT_COAP_DEFAULT_TOKEN_LENGTH);
+
+    error = otCoapMessageAppendUriPathOptions(request, DOWNLINK_URI_PATH);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    error = otCoapMessageSetPayloadMarker(request);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    error = otMessageAppend(request, payload, payload_len);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    printk("THREAD [DEBBUG]: Sending downlink request to %s\r\n", target);
+    error = otCoapSendRequest(srv_context.ot, request, &message_info,
+                  multicast ? NULL : downlink_response_handler, NULL);
+
+end:
+    if (error != OT_ERROR_NONE && request != NULL) {
+        otMessageFree(request);
+    }
+
+    openthread_api_mutex_unlock(openthread_get_default_context());
+    return error == OT_ERROR_NONE ? 0 : -EIO;
+}
+
+static void server_group_subscribe(bool subscribe)
+{
+    const uint8_t group_addr[] = GROUP_MULTICAST_ADDR(GROUP_ID_SERVERS + CONFIG_SERVER_SHARD_INDEX);
+    otIp6Address addr;
+    otError error;
+
+    memcpy(addr.mFields.m8, group_addr, sizeof(group_addr));
+
+    if (subscribe) {
+        error = otIp6SubscribeMulticastAddress(srv_context.ot, &addr);
+    } else {
+        error = otIp6UnsubscribeMulticastAddress(srv_context.ot, &addr);
+    }
+    if ((error != OT_ERROR_NONE) && (error != OT_ERROR_ALREADY) && (error != OT_ERROR_NOT_FOUND)) {
+        printk("THREAD [ERROR]: Cannot update servers multicast group, error: %d\r\n", error);
+    }
+}
+
+static void service_register(void)
+{
+    otServiceConfig config;
+    otError error;
+
+    memset(&config, 0, sizeof(config));
+    config.mEnterpriseNumber = SERVICE_ENTERPRISE_NUMBER;
+    config.mServiceDataLength = strlen(SERVICE_NAME);
+    memcpy(config.mServiceData, SERVICE_NAME, config.mServiceDataLength);
+
+    // Server data: CoAP port, shard of the clients owned by this server and epoch
+    config.mServerConfig.mStable = true;
+    config.mServerConfig.mServerDataLength = SERVICE_SERVER_DATA_SIZE;
+    config.mServerConfig.mServerData[0] = COAP_PORT >> 8;
+    config.mServerConfig.mServerData[1] = COAP_PORT & 0xff;
+    config.mServerConfig.mServerData[2] = CONFIG_SERVER_SHARD_INDEX;
+    config.mServerConfig.mServerData[3] = CONFIG_SERVER_SHARD_COUNT;
+    config.mServerConfig.mServerData[4] = server_epoch;
+
+    error = otServerAddService(srv_context.ot, &config);
+    if (error == OT_ERROR_NONE) {
+        error = otServerRegister(srv_context.ot);
+    }
+    if ((error != OT_ERROR_NONE) && (error != OT_ERROR_ALREADY)) {
+        printk("THREAD [ERROR]: Cannot register %s service, error: %d\r\n", SERVICE_NAME, error);
+        return;
+    }
+    printk("THREAD [DEBBUG]: %s service registered in network data (epoch %d)\r\n", SERVICE_NAME, server_epoch);
+}
+
+static void service_unregister(void)
+{
+    otError error = otServerRemoveService(srv_context.ot, SERVICE_ENTERPRISE_NUMBER,
+                                          SERVICE_NAME, strlen(SERVICE_NAME));
+    if (error == OT_ERROR_NONE) {
+        error = otServerRegister(srv_context.ot);
+    }
+    if ((error != OT_ERROR_NONE) && (error != OT_ERROR_NOT_FOUND)) {
+        printk("THREAD [ERROR]: Cannot remove %s service, error: %d\r\n", SERVICE_NAME, error);
+    }
+}
+
+/* Send a non confirmable PUT to a multicast group, must be called with the OpenThread API mutex held */
+static otError group_request_send(uint16_t group_id, const char *uri_path, const uint8_t *payload, uint16_t payload_len)
+{
+    otError error = OT_ERROR_NO_BUFS;
+    otMessage *request = NULL;
+    otMessageInfo message_info;
+    const uint8_t group_addr[] = GROUP_MULTICAST_ADDR(group_id);
+
+    memset(&message_info, 0, sizeof(message_info));
+    message_info.mPeerPort = COAP_PORT;
+    memcpy(message_info.mPeerAddr.mFields.m8, group_addr, sizeof(group_addr));
+
+    request = otCoapNewMessage(srv_context.ot, NULL);
+    if (request == NULL) {
+        goto end;
+    }
+
+    otCoapMessageInit(request, OT_COAP_TYPE_NON_CONFIRMABLE, OT_COAP_CODE_PUT);
+    otCoapMessageGenerateToken(request, OT_COAP_DEFAULT_TOKEN_LENGTH);
+
+    error = otCoapMessageAppendUriPathOptions(request, uri_path);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    error = otCoapMessageSetPayloadMarker(request);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    error = otMessageAppend(request, payload, payload_len);
+    if (error != OT_ERROR_NONE) {
+        goto end;
+    }
+
+    error = otCoapSendRequest(srv_context.ot, request, &message_info, NULL, NULL);
+
+end:
+    if (error != OT_ERROR_NONE && request != NULL) {
+        otMessageFree(request);
+    }
+    return error;
+}
+
+/* Send the state to the standby servers of the shard, also used as heartbeat */
+static void heartbeat_send(struct k_work *item)
+{
+    uint8_t payload[REPLICATION_PAYLOAD_SIZE];
+
+    ARG_UNUSED(item);
+
+    openthread_api_mutex_lock(openthread_get_default_context());
+
+    if (!server_active) {
+        goto end;
+    }
+
+    payload[0] = server_epoch;
+    sys_put_be32(state_version_get(), &payload[1]);
+    payload[5] = (srv_context.wifi_status ? REPLICATION_WIFI_BIT : 0) |
+                 (srv_context.presence_status ? REPLICATION_PRESENCE_BIT : 0) |
+                 (srv_context.electrical_status ? REPLICATION_ELECTRICAL_BIT : 0) |
+                 (srv_context.power_strip_r1_status ? REPLICATION_R1_BIT : 0) |
+                 (srv_context.power_strip_r2_status ? REPLICATION_R2_BIT : 0) |
+                 (srv_context.power_strip_r3_status ? REPLICATION_R3_BIT : 0) |
+                 (srv_context.power_strip_r4_status ? REPLICATION_R4_BIT : 0);
+    sys_put_be16(otThreadGetRloc16(srv_context.ot), &payload[6]);
+
+    group_request_send(GROUP_ID_SERVER_REPLICAS + CONFIG_SERVER_SHARD_INDEX, REPLICATION_URI_PATH,
+                       payload, sizeof(payload));
+    k_work_reschedule(&heartbeat_work, K_MSEC(CONFIG_SERVER_HEARTBEAT_INTERVAL_MS));
+
+end:
+    openthread_api_mutex_unlock(openthread_get_default_context());
+}
+
+/* Notify all the status subscribers with a single multicast message carrying the state version */
+static void status_notify_send(struct k_work *item)
+{
+    char payload[sizeof(NOTIFY_VERSION_PREFIX) + 10];
+
+    ARG_UNUSED(item);
+
+    openthread_api_mutex_lock(openthread_get_default_context());
+
+    if (server_active) {
+        uint32_t version = state_version_get();
+        uint16_t payload_len = snprintk(payload, sizeof(payload), NOTIFY_VERSION_PREFIX "%u", version);
+        otError error = group_request_send(GROUP_ID_STATUS_SUBSCRIBERS + CONFIG_SERVER_SHARD_INDEX, NOTIFY_URI_PATH,
+                                           payload, payload_len);
+        if (error == OT_ERROR_NONE) {
+            status_notifications ++;
+            printk("THREAD [DEBBUG]: Status subscribers notified, version %u (%d notifications sent)\r\n",
+                   version, status_notifications);
+        } else {
+            printk("THREAD [ERROR]: Cannot notify status subscribers, error: %d\r\n", error);
+        }
+    }
+
+    openthread_api_mutex_unlock(openthread_get_default_context());
+}
+
+/* Heartbeats of the active server stopped: take over its service */
+static void failover_handler(struct k_work *item)
+{
+    char report[MSG_MAX_SIZE];
+    int report_len = 0;
+
+    ARG_UNUSED(item);
+
+    openthread_api_mutex_lock(openthread_get_default_context());
+
+    if (!server_active) {
+        server_active = true;
+        server_epoch = SERVER_EPOCH_NEXT(server_epoch);
+        server_group_subscribe(true);
+        service_register();
+        k_work_reschedule(&heartbeat_work, K_NO_WAIT);
+
+        if (last_heartbeat_time > 0) {
+            int failover_time = (int)(k_uptime_get() - last_heartbeat_time);
+            printk("SERVER [DEBBUG]: Active server lost, took over %d ms after its last heartbeat\r\n",
+                   failover_time);
+            report_len = snprintk(report, sizeof(report), "%s%d", FAILOVER_REPORT_PREFIX, failover_time);
+        } else {
+            printk("SERVER [DEBBUG]: No active server, took over\r\n");
+        }
+    }
+
+    openthread_api_mutex_unlock(openthread_get_default_context());
+
+    // Report the failover time to the gateway, the clients report the requests they lost
+    if ((report_len > 0) && (report_len < sizeof(report))) {
+        gateway_record_forward(report);
+    }
+}
+
+static void replication_request_handler(void *context, otMessage *message,
+                    const otMessageInfo *message_info)
+{
+    uint8_t payload[REPLICATION_PAYLOAD_SIZE];
+
+    ARG_UNUSED(context);
+    ARG_UNUSED(message_info);
+
+    if ((otCoapMessageGetType(message) != OT_COAP_TYPE_NON_CONFIRMABLE) ||
+        (otCoapMessageGetCode(message) != OT_COAP_CODE_PUT)) {
+        return;
+    }
+
+    if (otMessageRead(message, otMessageGetOffset(message), payload, sizeof(payload)) != sizeof(payload)) {
+        return;
+    }
+
+    uint8_t epoch = payload[0];
+    uint16_t rloc16 = sys_get_be16(&payload[6]);
+
+    if (server_active) {
+        // Another server took over: become standby. Two servers of the same epoch (both took over
+        // or both never did) keep the one with the lowest RLOC16
+        if (!SERVER_EPOCH_NEWER(epoch, server_epoch) &&
+            ((epoch != server_epoch) || (rloc16 >= otThreadGetRloc16(srv_context.ot)))) {
+            return;
+        }
+        printk("SERVER [DEBBUG]: Server %04x with epoch %d active, switching to standby\r\n", rloc16, epoch);
+        server_active = false;
+        k_work_cancel_delayable(&heartbeat_work);
+        server_group_subscribe(false);
+        service_unregister();
+    } else if (SERVER_EPOCH_NEWER(server_epoch, epoch)) {
+        // Stale server, e.g. an active server rebooted without its epoch
+        return;
+    }
+
+    server_epoch = epoch;
+    atomic_set(&srv_context.state_version, sys_get_be32(&payload[1]));
+    srv_context.wifi_status = payload[5] & REPLICATION_WIFI_BIT;
+    srv_context.presence_status = payload[5] & REPLICATION_PRESENCE_BIT;
+    srv_context.electrical_status = payload[5] & REPLICATION_ELECTRICAL_BIT;
+    srv_context.power_strip_r1_status = payload[5] & REPLICATION_R1_BIT;
+    srv_context.power_strip_r2_status = payload[5] & REPLICATION_R2_BIT;
+    srv_context.power_strip_r3_status = payload[5] & REPLICATION_R3_BIT;
+    srv_context.power_strip_r4_status = payload[5] & REPLICATION_R4_BIT;
+
+    last_heartbeat_time = k_uptime_get();
+    k_work_reschedule(&failover_work, K_MSEC(CONFIG_SERVER_FAILOVER_TIMEOUT_MS));
+}
+
+void ot_coap_server_start(void)
+{
+    const uint8_t replicas_addr[] = GROUP_MULTICAST_ADDR(GROUP_ID_SERVER_REPLICAS + CONFIG_SERVER_SHARD_INDEX);
+    otIp6Address addr;
+
+    memcpy(addr.mFields.m8, replicas_addr, sizeof(replicas_addr));
+
+    otError error = otIp6SubscribeMulticastAddress(srv_context.ot, &addr);
+    if ((error != OT_ERROR_NONE) && (error != OT_ERROR_ALREADY)) {
+        printk("THREAD [ERROR]: Cannot join replicas multicast group, error: %d\r\n", error);
+    }
+
+    if (server_active) {
+        server_group_subscribe(true);
+        service_register();
+        k_work_reschedule(&heartbeat_work, K_NO_WAIT);
+    } else {
+        k_work_reschedule(&failover_work, K_MSEC(CONFIG_SERVER_FAILOVER_TIMEOUT_MS));
+    }
+}
+
 static void coap_default_handler(void *context, otMessage *message,
                  const otMessageInfo *message_info)
 {
@@ -637,6 +1796,15 @@ int ot_coap_init(
     srv_context.on_power_strip_status_request = on_power_strip_status_request;
     srv_context.on_commands_request = on_commands_request;    
 
+    k_work_init(&gateway_ack_work, gateway_ack_handler);
+    k_work_init(&forward_work, commands_forward_handler);
+    k_work_init_delayable(&keep_alive_work, keep_alive_period_end);
+    k_work_schedule(&keep_alive_work, K_MSEC(CONFIG_CLIENT_KEEP_ALIVE_PERIOD_MS));
+    k_work_init_delayable(&pending_commands_timeout_work, pending_commands_timeout_handler);
+    k_work_init_delayable(&heartbeat_work, heartbeat_send);
+    k_work_init_delayable(&failover_work, failover_handler);
+    k_work_init(&status_notify_work, status_notify_send);
+
     srv_context.ot = openthread_get_default_instance();
     if (!srv_context.ot) {
         error = OT_ERROR_FAILED;
@@ -658,9 +1826,17 @@ int ot_coap_init(
     power_strip_status_resource.mContext = srv_context.ot;
     power_strip_status_resource.mHandler = power_strip_status_request_handler;
 
+    for (int i = 0; i < ARRAY_SIZE(power_strip_relay_resources); i++) {
+        power_strip_relay_resources[i].mContext = INT_TO_POINTER(i + 1);
+        power_strip_relay_resources[i].mHandler = power_strip_relay_request_handler;
+    }
+
     commands_resource.mContext = srv_context.ot;
     commands_resource.mHandler = commands_request_handler;
 
+    replication_resource.mContext = srv_context.ot;
+    replication_resource.mHandler = replication_request_handler;
+
     otCoapSetDefaultHandler(srv_context.ot, coap_default_handler, NULL);
     otCoapAddResource(srv_context.ot, &commands_resource);
     otCoapAddResource(srv_context.ot, &ressources_status_resource);
@@ -668,6 +1844,10 @@ int ot_coap_init(
     otCoapAddResource(srv_context.ot, &presence_status_resource);
     otCoapAddResource(srv_context.ot, &electrical_status_resource);
     otCoapAddResource(srv_context.ot, &power_strip_status_resource);
+    for (int i = 0; i < ARRAY_SIZE(power_strip_relay_resources); i++) {
+        otCoapAddResource(srv_context.ot, &power_strip_relay_resources[i]);
+    }
+    otCoapAddResource(srv_context.ot, &replication_resource);
 
     error = otCoapStart(srv_context.ot, COAP_PORT);
     if (error != OT_ERROR_NONE) {
@@ -8,10 +8,16 @@
 #define __OT_COAP_UTILS_H__
 
 #include <thread_dongle_interface.h>
+#include <relays_mask.h>
 
 /**@brief Type definition of the function used to handle commands resource msg.
+ *
+ * Called from the system workqueue for each record to forward to the gateway, in the order
+ * the records were received. Each UART frame must be reported with commands_uart_frame_sent(),
+ * or commands_uart_frame_failed() when it could not be written. received_time is the uptime
+ * at which the server received the record.
  */
-typedef void (*commands_request_callback_t)(uint8_t* msg_buf, uint8_t msg_len);
+typedef void (*commands_request_callback_t)(uint8_t* msg_buf, uint8_t msg_len, int64_t received_time);
 /**@brief Type definition of the function used to handle ressources status resource msg.
  */
 typedef void (*ressources_status_request_callback_t)();
@@ -52,8 +58,45 @@ void set_electrical_status(bool new_status);
  */
 void set_power_strip_status(bool new_r1_status, bool new_r2_status, bool new_r3_status, bool new_r4_status);
 
+/**@brief Set the power strip relays in mask to their bit in values, bit n for relay n+1.
+ */
+void set_power_strip_relays(uint8_t mask, uint8_t values);
+
 /**@brief Type definition of the function used to print current status.
  */
 void print_ressources_status();
 
+/**@brief Report a UART frame carrying the next records forwarded to the gateway.
+ *
+ * The commands whose last record is in the frame are answered once the gateway acknowledges it.
+ *
+ * @param records number of records in the frame.
+ */
+void commands_uart_frame_sent(uint8_t records);
+
+/**@brief Report a UART frame carrying the next records forwarded to the gateway that could not be written.
+ *
+ * The commands with a record in the frame are answered right away with a 5.02 error.
+ *
+ * @param records number of records in the frame.
+ */
+void commands_uart_frame_failed(uint8_t records);
+
+/**@brief Acknowledge the oldest commands UART frame, may be called from ISR.
+ */
+void commands_gateway_ack_received(void);
+
+/**@brief Start serving the clients, or wait as standby for the active server of the shard to stop.
+ *
+ * The active server joins the servers multicast group, advertises its service in Thread Network Data
+ * and replicates its state to the standby servers.
+ */
+void ot_coap_server_start(void);
+
+/**@brief Send a downlink request to a client.
+ *
+ * @param target r<rloc16>, e<mesh-local EID>, d<device id> or g<multicast group id>.
+ */
+int ot_coap_send_downlink(const char *target, const uint8_t *payload, uint16_t payload_len);
+
 #endif
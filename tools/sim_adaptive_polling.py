@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+# Simulate the status polling of a client over a synthetic trace of status
+# changes on the server, with a fixed period and with the adaptive period of
+# the periodic scheduler (back to the minimum on a change, doubled up to the
+# maximum on each poll without a change).
+#
+# Usage: python3 tools/sim_adaptive_polling.py [seeds]
+#
+# The trace is synthetic: bursts of 1 to 4 changes, 2 to 30 s apart, arriving
+# on average every 10 min. It is not a capture of a real installation.
+# Staleness is the mean time from a change to the poll that sees it.
+
+import random
+import sys
+
+DURATION_S = 24 * 3600
+BURST_INTERVAL_S = 600
+
+# (client, [(min period s, max period s), ...]), the first entry is the fixed period of the original code
+CASES = (
+    ("power strip", [(2, 2), (1, 8), (2, 32)]),
+    ("badge/camera", [(10, 10), (5, 40)]),
+)
+
+
+def changes_trace(seed):
+    rnd = random.Random(seed)
+    changes = []
+    t = 0
+    while True:
+        t += rnd.expovariate(1 / BURST_INTERVAL_S)
+        if t > DURATION_S:
+            break
+        change = t
+        for _ in range(rnd.randint(1, 4)):
+            changes.append(change)
+            change += rnd.uniform(2, 30)
+    return sorted(c for c in changes if c < DURATION_S)
+
+
+def simulate(changes, min_period, max_period):
+    t = 0
+    period = min_period
+    next_change = 0
+    staleness = []
+    polls = 0
+
+    while t < DURATION_S:
+        t += period
+        polls += 1
+        changed = False
+        while next_change < len(changes) and changes[next_change] <= t:
+            staleness.append(t - changes[next_change])
+            next_change += 1
+            changed = True
+        period = min_period if changed else min(period * 2, max_period)
+
+    return sum(staleness) / len(staleness), polls / (DURATION_S / 3600)
+
+
+if __name__ == "__main__":
+    seeds = int(sys.argv[1]) if len(sys.argv) > 1 else 20
+    traces = [changes_trace(seed) for seed in range(seeds)]
+    for client, periods in CASES:
+        for min_period, max_period in periods:
+            results = [simulate(trace, min_period, max_period) for trace in traces]
+            name = "fixed %d s" % min_period if min_period == max_period else "adaptive %d-%d s" % (min_period, max_period)
+            print("%-13s %-16s staleness %4.1f s, %4.0f requests/h"
+                  % (client, name, sum(r[0] for r in results) / seeds, sum(r[1] for r in results) / seeds))
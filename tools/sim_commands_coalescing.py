@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+# Benchmark the server commands coalescing window on the host. The commands
+# reach the server in bursts (back to back key presses, UART frames of several
+# clients) on top of the keep alive msgs, and are forwarded to the gateway like
+# coap_server.c does: the first command opens the window, which is flushed
+# when it elapses, when CONFIG_COMMANDS_COALESCING_MAX_RECORDS commands are
+# waiting or right away on an alarm. Window 0 writes each command in its own
+# ~cmd# frame.
+#
+# Usage: python3 tools/sim_commands_coalescing.py [clients] [seed]
+#
+# The latency is counted from the reception of a command to the end of the
+# UART transmission of its frame, at the default 115200 baud 8N1. The CoAP
+# handling and the gateway processing are not modelled, so the figures compare
+# the windows with each other, not with a measurement on a dongle.
+
+import random
+import sys
+
+UART_BYTES_PER_MS = 115200 / 10 / 1000
+MAX_RECORDS = 8
+DURATION_MS = 3_600_000
+WINDOWS_MS = (0, 5, 10, 20, 50, 100)
+KEEP_ALIVE_PERIOD_MS = 10_000
+# Bursts of commands per client and per hour, commands per burst and spacing within a burst
+BURSTS_PER_HOUR = 30
+BURST_COMMANDS = (1, 6)
+BURST_SPACING_MS = (2, 40)
+ALARMS_PER_HOUR = 1
+COMMAND = b"cmd_12"
+KEEP_ALIVE = b"ka_3"
+ALARM = b"al_bt_em"
+
+
+def traffic(clients, seed):
+    rnd = random.Random(seed)
+    commands = []
+    for _ in range(clients):
+        t = rnd.uniform(0, KEEP_ALIVE_PERIOD_MS)
+        while t < DURATION_MS:
+            commands.append((t, KEEP_ALIVE))
+            t += KEEP_ALIVE_PERIOD_MS
+        t = rnd.expovariate(BURSTS_PER_HOUR / 3_600_000)
+        while t < DURATION_MS:
+            burst_t = t
+            for _ in range(rnd.randint(*BURST_COMMANDS)):
+                commands.append((burst_t, COMMAND))
+                burst_t += rnd.uniform(*BURST_SPACING_MS)
+            t += rnd.expovariate(BURSTS_PER_HOUR / 3_600_000)
+        t = rnd.expovariate(ALARMS_PER_HOUR / 3_600_000)
+        while t < DURATION_MS:
+            commands.append((t, ALARM))
+            t += rnd.expovariate(ALARMS_PER_HOUR / 3_600_000)
+    commands.sort()
+    return commands
+
+
+def simulate(commands, window_ms):
+    uart_free = 0.0
+    frames = 0
+    uart_bytes = 0
+    latencies = []
+    batch = []
+    batch_deadline = None
+
+    def flush(t):
+        nonlocal uart_free, frames, uart_bytes
+        frame_len = 2 + sum(len(record) for _, record in batch) + len(batch) - 1
+        uart_free = max(t, uart_free) + frame_len / UART_BYTES_PER_MS
+        frames += 1
+        uart_bytes += frame_len
+        latencies.extend(uart_free - received for received, _ in batch)
+        batch.clear()
+
+    for t, record in commands:
+        if batch and t >= batch_deadline:
+            flush(batch_deadline)
+        batch.append((t, record))
+        if window_ms == 0 or record == ALARM or len(batch) >= MAX_RECORDS:
+            flush(t)
+        elif len(batch) == 1:
+            batch_deadline = t + window_ms
+    if batch:
+        flush(batch_deadline)
+
+    latencies.sort()
+    seconds = DURATION_MS / 1000
+    return (frames / seconds, uart_bytes / seconds, sum(latencies) / len(latencies),
+            latencies[int(len(latencies) * 0.99)], latencies[-1])
+
+
+if __name__ == "__main__":
+    clients = int(sys.argv[1]) if len(sys.argv) > 1 else 50
+    seed = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+    commands = traffic(clients, seed)
+    print("%d clients, %.2f commands/s over %d s, at most %d records per frame"
+          % (clients, len(commands) / (DURATION_MS / 1000), DURATION_MS // 1000, MAX_RECORDS))
+    for window_ms in WINDOWS_MS:
+        frames_s, bytes_s, mean, p99, worst = simulate(commands, window_ms)
+        print("window %3d ms: %6.2f frames/s  %7.1f UART bytes/s  latency mean %6.2f ms  p99 %6.2f ms  max %6.2f ms"
+              % (window_ms, frames_s, bytes_s, mean, p99, worst))
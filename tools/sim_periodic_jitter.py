@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+# Simulate the requests rate at the server when all the clients boot at the
+# same time, with fixed periods and with the periodic scheduler (random
+# start offset within the period, +/- CONFIG_PERIODIC_JITTER_PERCENT per period).
+#
+# Usage: python3 tools/sim_periodic_jitter.py [seed]
+#
+# This models the scheduler only, it is not a measurement on a Thread network.
+
+import random
+import sys
+
+DURATION_MS = 600_000
+BIN_MS = 100
+BOOT_SPREAD_MS = 50
+JITTER_PERCENT = 10
+
+# Periods of the periodic tasks of each node, in ms
+NODES = (
+    [[10000]] * 10 +          # badges and cameras: status polling
+    [[2000, 10000]] * 10 +    # power strips: status polling and keep alive
+    [[10000]] * 5 +           # buttons matrices: keep alive
+    [[20000]] * 5             # buttons: keep alive
+)
+
+
+def simulate(jitter, seed):
+    rnd = random.Random(seed)
+    bins = [0] * (DURATION_MS // BIN_MS + 1)
+    requests = 0
+
+    for periods in NODES:
+        boot = rnd.uniform(0, BOOT_SPREAD_MS)
+        for period in periods:
+            t = boot + (rnd.uniform(0, period) if jitter else period)
+            while t < DURATION_MS:
+                bins[int(t // BIN_MS)] += 1
+                requests += 1
+                delta = period * JITTER_PERCENT / 100
+                t += period + (rnd.uniform(-delta, delta) if jitter else 0)
+
+    return max(bins), requests / (DURATION_MS / 1000)
+
+
+if __name__ == "__main__":
+    seed = int(sys.argv[1]) if len(sys.argv) > 1 else 1
+    for jitter in (False, True):
+        peak, mean = simulate(jitter, seed)
+        print("%-7s peak %2d requests/%d ms, mean %.2f requests/s"
+              % ("jitter" if jitter else "fixed", peak, BIN_MS, mean))
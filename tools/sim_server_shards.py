@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Simulate the commands load of the clients spread over 1, 2 and 4 server
+# nodes. Each client is assigned to the shard of the FNV-1a hash of a random
+# EUI-64, like coap_client_utils.c does. Each server handles its requests one
+# at a time: CoAP handling plus the UART write of a ~cmd# frame.
+#
+# Usage: python3 tools/sim_server_shards.py [clients] [seed]
+#
+# The CoAP handling time is an assumption, not a measurement on a dongle; the
+# UART time assumes the default 115200 baud 8N1. Queues are unbounded here, the
+# server answers 5.03 once its forward queue is full. The Thread mesh is not
+# modelled, so the figures only show how the server side scales.
+
+import heapq
+import random
+import sys
+
+COAP_HANDLING_MS = 2.0
+UART_BYTES_PER_MS = 115200 / 10 / 1000
+FRAME_BYTES = 12
+SERVICE_MS = COAP_HANDLING_MS + FRAME_BYTES / UART_BYTES_PER_MS
+DURATION_MS = 600_000
+SHARDS = (1, 2, 4)
+# Commands per second offered by all the clients together
+LOADS = (100, 200, 400, 800)
+
+
+def fnv1a(data):
+    h = 2166136261
+    for byte in data:
+        h = ((h ^ byte) * 16777619) & 0xffffffff
+    return h
+
+
+def simulate(clients, shards, load, seed):
+    rnd = random.Random(seed)
+    hashes = [fnv1a(rnd.randbytes(8)) for _ in range(clients)]
+    rate_per_client = load / clients / 1000
+
+    # Poisson arrivals of each client, merged in time order
+    arrivals = []
+    for h in hashes:
+        t = rnd.expovariate(rate_per_client)
+        while t < DURATION_MS:
+            arrivals.append((t, h % shards))
+            t += rnd.expovariate(rate_per_client)
+    heapq.heapify(arrivals)
+
+    busy_until = [0.0] * shards
+    handled = [0] * shards
+    latencies = []
+    while arrivals:
+        t, shard = heapq.heappop(arrivals)
+        start = max(t, busy_until[shard])
+        busy_until[shard] = start + SERVICE_MS
+        handled[shard] += 1
+        latencies.append(busy_until[shard] - t)
+
+    latencies.sort()
+    return (len(latencies) / (max(busy_until) / 1000), sum(latencies) / len(latencies),
+            latencies[int(len(latencies) * 0.99)], max(handled) / (sum(handled) / shards))
+
+
+if __name__ == "__main__":
+    clients = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+    seed = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+    print("%d clients, %.2f ms per command and server (%.1f ms CoAP, %.2f ms UART)"
+          % (clients, SERVICE_MS, COAP_HANDLING_MS, FRAME_BYTES / UART_BYTES_PER_MS))
+    for load in LOADS:
+        for shards in SHARDS:
+            throughput, mean, p99, imbalance = simulate(clients, shards, load, seed)
+            print("offered %4d cmd/s  %d server(s): handled %6.1f cmd/s  latency mean %8.1f ms  p99 %8.1f ms  "
+                  "busiest shard %.2fx the mean" % (load, shards, throughput, mean, p99, imbalance))